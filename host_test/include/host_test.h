@@ -0,0 +1,59 @@
+/** @file host_test.h
+ *
+ * Home Buzzer - host tests
+ * ==========================================
+ *
+ * `HOST_CHECK()` reports the failed condition and continues,
+ * `host_test_result()` is the exit code of the test.
+ * `host_test_nsec()` times the benchmarks, build them with
+ * `-DHOST_TEST_SANITIZE=OFF` for the figures.
+ */
+#pragma once
+#include <stdint.h>
+#include <chrono>
+#include <cstdio>
+
+
+inline int host_test_failures = 0;
+
+#define HOST_CHECK(cond) do { \
+    if (!(cond)) { \
+        std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+
+/// xorshift32, the same generator as the storm and the simulations.
+struct host_test_rand {
+    uint32_t seed;
+
+    uint32_t operator()() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+};
+
+
+/// nsec per call of `fn`, the best of `n_runs` runs by `n_calls` calls.
+template <class F>
+double host_test_nsec(int n_runs, int n_calls, F fn) {
+    double ret = 0;
+    for (int i = 0; i < n_runs; i++) {
+        auto t = std::chrono::steady_clock::now();
+        for (int j = 0; j < n_calls; j++) {fn();}
+        std::chrono::duration<double, std::nano> d =
+            std::chrono::steady_clock::now() - t;
+        auto ns = d.count() / n_calls;
+        ret = i == 0 || ns < ret ? ns : ret;
+    }
+    return ret;
+}
+
+
+inline int host_test_result(const char* name) {
+    std::printf("%s: %s\n", name, host_test_failures ? "FAILED" : "passed");
+    return host_test_failures ? 1 : 0;
+}
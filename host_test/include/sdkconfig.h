@@ -0,0 +1,9 @@
+/** @file sdkconfig.h
+ *
+ * Home Buzzer - host tests
+ * ==========================================
+ *
+ * stands in for the generated ESP-IDF configuration,
+ * the options for each test are set by `CMakeLists.txt`.
+ */
+#pragma once
@@ -0,0 +1,104 @@
+/** @file test_adv.cpp
+ *
+ * Home Buzzer - host tests of the advertisement payload
+ * ==========================================
+ *
+ * - every truncation of a batch is rejected as a whole.
+ * - random payloads and AD structures are decoded without reading
+ *   out of the data (checked by ASan, the copies have the exact size).
+ */
+#include <stdint.h>
+#include <vector>
+
+#include "buzzer_adv.h"
+#include "host_test.h"
+
+
+static void test_truncated() {
+    const std::vector<uint8_t> batch = {
+        0xff, 0xff, BUZZER_ADV_BATCH_V1, 0x01, 0x00, 2,
+        1, 4, 3, 200,
+        2, 6, 9, 255};
+    const std::vector<uint8_t> timed = {
+        0xff, 0xff, BUZZER_ADV_BATCH_V2, 0x02, 0x00, 0x10, 0x27, 0x2c, 0x28, 1,
+        BUZZER_ADV_TARGET_ALL, 7, 0, 255};
+    for (const auto& src : {batch, timed}) {
+        for (size_t len = 0; len < src.size(); len++) {
+            std::vector<uint8_t> tmp(src.begin(), src.begin() + len);
+            for (uint8_t target : {1, 2, 3}) {
+                HOST_CHECK(buzzer_adv_decode(tmp.data(), len, target).sound ==
+                           -1);
+            }
+        }
+    }
+    HOST_CHECK(buzzer_adv_decode(batch.data(), batch.size(), 2).sound == 6);
+    HOST_CHECK(buzzer_adv_decode(timed.data(), timed.size(), 3).sound == 7);
+}
+
+
+static void test_random_payload() {
+    host_test_rand rand = {0x1234567};
+    for (int i = 0; i < 100000; i++) {
+        auto r = rand();
+        std::vector<uint8_t> src(r % 32);
+        for (auto& v : src) {v = rand();}
+        if (src.size() > 2 && (r & 0x100)) {
+            src[2] = r & 0x200 ? BUZZER_ADV_BATCH_V1 : BUZZER_ADV_BATCH_V2;
+        }
+        auto rec = buzzer_adv_decode(src.data(), src.size(), r >> 24);
+        HOST_CHECK(rec.sound >= -1 && rec.sound <= 255);
+        HOST_CHECK(!rec.timed || src.size() > BUZZER_ADV_OFS_COUNT_V2);
+    }
+}
+
+
+static void test_random_ad() {
+    host_test_rand rand = {0x89abcdef};
+    for (int i = 0; i < 100000; i++) {
+        auto r = rand();
+        std::vector<uint8_t> src;
+        // - well-formed AD structures with the service at a random place,
+        //   and sometimes a broken length at the end.
+        int n = r % 4;
+        bool with_uuid = r & 0x10;
+        for (int j = 0; j < n; j++) {
+            int len = 1 + rand() % 8;
+            src.push_back(len);
+            src.push_back(rand() % 4 ? 0x09 : BUZZER_ADV_AD_UUID16_COMP);
+            for (int k = 1; k < len; k++) {src.push_back(0x00);}
+        }
+        if (with_uuid) {
+            src.insert(src.end(), {0x03, BUZZER_ADV_AD_UUID16_INCOMP,
+                                   0x11, 0x18});
+        }
+        bool broken = r & 0x20;
+        if (broken) {src.insert(src.end(), {0x05, 0xff, 0x01});}
+
+        auto found = buzzer_adv_uuid16(src.data(), src.size(), 0x1811);
+        if (broken) {
+            HOST_CHECK(found == BUZZER_ADV_MALFORMED ||
+                       (with_uuid && found >= 0));
+        } else {
+            HOST_CHECK(with_uuid ? found >= 0 : found == -1);
+        }
+        auto [mfg, len] = buzzer_adv_field(src.data(), src.size(),
+                                           BUZZER_ADV_AD_MFG_DATA);
+        HOST_CHECK(mfg == nullptr && len == 0);
+
+        // - and random bytes.
+        for (auto& v : src) {v = rand();}
+        buzzer_adv_uuid16(src.data(), src.size(), 0x1811);
+        std::tie(mfg, len) = buzzer_adv_field(src.data(), src.size(),
+                                              BUZZER_ADV_AD_MFG_DATA);
+        HOST_CHECK(len >= 0 && (mfg == nullptr ||
+                                mfg + len <= src.data() + src.size()));
+    }
+}
+
+
+int main() {
+    test_truncated();
+    test_random_payload();
+    test_random_ad();
+    return host_test_result("adv");
+}
@@ -0,0 +1,367 @@
+/** @file test_bank.cpp
+ *
+ * Home Buzzer - host tests of the sound bank upload
+ * ==========================================
+ *
+ * the states of `buzzer_bank.h` over a fake card in memory:
+ *
+ * - a committed bank replaces the files, and the catalog is refreshed
+ *   once with the new files in place.
+ * - a bad CRC or size removes the file, the channel closed before the
+ *   commit removes all.
+ * - a failed rename at any step restores the old files.
+ * - random SDUs never touch the card without taking it.
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "buzzer_bank.h"
+#include "host_test.h"
+
+
+using disk = std::map<std::string, std::vector<uint8_t>>;
+
+/// the storage of `buzzer_bank.h` in memory, a rename fails on a file.
+struct fake_fs {
+    disk files;
+    bool present = true;        /// false: the card is removed
+    bool taken = false;
+    std::string open;           /// the file to write, empty if none
+    int n_moves = 0;            /// the moves possible on the files
+    int fail_move = -1;         /// the one to fail, by `n_moves`
+    int n_refresh = 0;
+    disk refreshed;             /// the files at the refresh
+    int n_untaken = 0;          /// accesses without the storage
+
+    void access() {n_untaken += taken ? 0 : 1;}
+
+    static std::string path(buzzer_bank_name kind, int i, const char* name) {
+        switch (kind) {
+        case buzzer_bank_name::TMP:
+            return "UPLOAD" + std::to_string(i) + ".TMP";
+        case buzzer_bank_name::BAK:
+            return "UPLOAD" + std::to_string(i) + ".BAK";
+        case buzzer_bank_name::DST:
+            break;
+        }
+        return name;
+    }
+
+    bool take() {
+        if (!present) {return false;}
+        HOST_CHECK(!taken);
+        taken = true;
+        return true;
+    }
+
+    void give(bool refresh) {
+        access();
+        if (refresh) {
+            n_refresh++;
+            refreshed = files;
+        }
+        taken = false;
+    }
+
+    bool create(int i) {
+        access();
+        open = path(buzzer_bank_name::TMP, i, nullptr);
+        files[open].clear();
+        return true;
+    }
+
+    bool write(const uint8_t* src, int len) {
+        access();
+        if (open.empty()) {return false;}
+        files[open].insert(files[open].end(), src, src + len);
+        return true;
+    }
+
+    /// without the storage only for the file of a removed card.
+    void close() {
+        if (open.empty()) {return;}
+        access();
+        open.clear();
+    }
+
+    /// as FAT: fails without the source, or over an existing file.
+    bool move(buzzer_bank_name from, buzzer_bank_name to, int i,
+              const char* name) {
+        access();
+        auto src = path(from, i, name), dst = path(to, i, name);
+        if (!files.count(src) || files.count(dst)) {return false;}
+        if (n_moves++ == fail_move) {return false;}
+        files[dst] = std::move(files[src]);
+        files.erase(src);
+        return true;
+    }
+
+    void remove(buzzer_bank_name kind, int i, const char* name) {
+        access();
+        files.erase(path(kind, i, name));
+    }
+
+    /// CRC32 as `esp_rom_crc32_le()`.
+    uint32_t crc(uint32_t crc, const uint8_t* src, int len) {
+        crc = ~crc;
+        for (int i = 0; i < len; i++) {
+            crc ^= src[i];
+            for (int k = 0; k < 8; k++) {
+                crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            }
+        }
+        return ~crc;
+    }
+};
+
+
+static bool temporary(const disk& files) {
+    for (const auto& [name, data] : files) {
+        if (name.rfind("UPLOAD", 0) == 0) {return true;}
+    }
+    return false;
+}
+
+
+static buzzer_upload_status begin(buzzer_bank<fake_fs>& b, const char* name,
+                                  uint32_t size) {
+    std::vector<uint8_t> sdu = {BUZZER_UPLOAD_BEGIN};
+    sdu.insert(sdu.end(), (uint8_t*)&size, (uint8_t*)&size + 4);
+    sdu.insert(sdu.end(), name, name + strlen(name) + 1);
+    return buzzer_bank_feed(b, sdu.data(), sdu.size());
+}
+
+
+static buzzer_upload_status end(buzzer_bank<fake_fs>& b, uint32_t crc) {
+    uint8_t sdu[5] = {BUZZER_UPLOAD_END};
+    memcpy(&sdu[1], &crc, 4);
+    return buzzer_bank_feed(b, sdu, sizeof(sdu));
+}
+
+
+static buzzer_upload_status commit(buzzer_bank<fake_fs>& b) {
+    const uint8_t sdu[1] = {BUZZER_UPLOAD_COMMIT};
+    return buzzer_bank_feed(b, sdu, 1);
+}
+
+
+/// upload a file by SDUs of `mtu`, with the right or a wrong CRC.
+static buzzer_upload_status upload(buzzer_bank<fake_fs>& b, const char* name,
+                                   const std::vector<uint8_t>& data,
+                                   int mtu, uint32_t crc_xor = 0) {
+    auto ret = begin(b, name, data.size());
+    if (ret != BUZZER_UPLOAD_NO_ACK) {return ret;}
+    std::vector<uint8_t> sdu;
+    for (size_t pos = 0; pos < data.size();) {
+        auto n = std::min<size_t>(mtu - 1, data.size() - pos);
+        sdu.assign(1, BUZZER_UPLOAD_DATA);
+        sdu.insert(sdu.end(), data.begin() + pos, data.begin() + pos + n);
+        ret = buzzer_bank_feed(b, sdu.data(), sdu.size());
+        if (ret != BUZZER_UPLOAD_NO_ACK) {return ret;}
+        pos += n;
+    }
+    return end(b, b.fs->crc(0, data.data(), data.size()) ^ crc_xor);
+}
+
+
+static std::vector<uint8_t> random_data(host_test_rand& rand, int n) {
+    std::vector<uint8_t> ret(n);
+    for (auto& v : ret) {v = rand();}
+    return ret;
+}
+
+
+/// the old card: `1A.WAV` is replaced twice, `2B.WAV` is new.
+struct bank_case {
+    disk old;
+    std::vector<std::pair<const char*, std::vector<uint8_t>>> files;
+};
+
+static bank_case make_case(host_test_rand& rand) {
+    bank_case ret;
+    ret.old["1A.WAV"] = random_data(rand, 300);
+    ret.old["3C.WAV"] = random_data(rand, 200);
+    ret.files = {{"1A.WAV", random_data(rand, 1000)},
+                 {"2B.WAV", random_data(rand, 77)},
+                 {"1A.WAV", random_data(rand, 513)}};
+    return ret;
+}
+
+
+static void test_commit() {
+    host_test_rand rand = {0xba4c};
+    auto c = make_case(rand);
+    fake_fs fs;
+    fs.files = c.old;
+    buzzer_bank<fake_fs> b;
+    buzzer_bank_init(b, &fs);
+    for (const auto& [name, data] : c.files) {
+        HOST_CHECK(upload(b, name, data, 128) == BUZZER_UPLOAD_OK);
+    }
+    HOST_CHECK(fs.n_refresh == 0);
+    HOST_CHECK(commit(b) == BUZZER_UPLOAD_OK);
+
+    disk expect = c.old;
+    for (const auto& [name, data] : c.files) {expect[name] = data;}
+    HOST_CHECK(fs.files == expect);
+    // - refreshed once, with all files in place, before the give.
+    HOST_CHECK(fs.n_refresh == 1 && fs.refreshed == expect);
+    HOST_CHECK(!fs.taken && fs.n_untaken == 0);
+    HOST_CHECK(b.n_files == 0 && commit(b) == BUZZER_UPLOAD_E_FORMAT);
+}
+
+
+static void test_broken() {
+    host_test_rand rand = {0xbad};
+    fake_fs fs;
+    buzzer_bank<fake_fs> b;
+    buzzer_bank_init(b, &fs);
+    auto data = random_data(rand, 700);
+
+    // - a bad CRC: the file is removed, the bank goes on.
+    HOST_CHECK(upload(b, "1A.WAV", data, 200) == BUZZER_UPLOAD_OK);
+    HOST_CHECK(upload(b, "2B.WAV", data, 200, 1) == BUZZER_UPLOAD_E_VERIFY);
+    HOST_CHECK(b.n_files == 1 && !fs.files.count("UPLOAD1.TMP"));
+    // - short of the size.
+    HOST_CHECK(begin(b, "2B.WAV", 701) == BUZZER_UPLOAD_NO_ACK);
+    HOST_CHECK(end(b, fs.crc(0, data.data(), 0)) == BUZZER_UPLOAD_E_VERIFY);
+    HOST_CHECK(b.n_files == 1 && !fs.files.count("UPLOAD1.TMP"));
+    // - over the size.
+    HOST_CHECK(upload(b, "2B.WAV", random_data(rand, 10), 64) ==
+               BUZZER_UPLOAD_OK);
+    HOST_CHECK(begin(b, "3C.WAV", 5) == BUZZER_UPLOAD_NO_ACK);
+    const uint8_t over[7] = {BUZZER_UPLOAD_DATA};
+    HOST_CHECK(buzzer_bank_feed(b, over, 7) == BUZZER_UPLOAD_E_VERIFY);
+    // - malformed names.
+    HOST_CHECK(begin(b, "A.WAV", 5) == BUZZER_UPLOAD_E_FORMAT);
+    HOST_CHECK(begin(b, "1/A.WAV", 5) == BUZZER_UPLOAD_E_FORMAT);
+    HOST_CHECK(begin(b, "1ABCDEFGH.WAV", 5) == BUZZER_UPLOAD_E_FORMAT);
+
+    HOST_CHECK(commit(b) == BUZZER_UPLOAD_E_FORMAT);    // - 3C is open
+    HOST_CHECK(end(b, 0) == BUZZER_UPLOAD_E_VERIFY);
+    HOST_CHECK(commit(b) == BUZZER_UPLOAD_OK);
+    HOST_CHECK(fs.files.size() == 2 && fs.files["1A.WAV"] == data);
+    HOST_CHECK(!temporary(fs.files) && fs.n_untaken == 0);
+}
+
+
+static void test_closed() {
+    host_test_rand rand = {0xc105e};
+    auto c = make_case(rand);
+    fake_fs fs;
+    fs.files = c.old;
+    buzzer_bank<fake_fs> b;
+    buzzer_bank_init(b, &fs);
+    HOST_CHECK(buzzer_bank_abort(b) == 0);
+    for (const auto& [name, data] : c.files) {
+        HOST_CHECK(upload(b, name, data, 100) == BUZZER_UPLOAD_OK);
+    }
+    HOST_CHECK(begin(b, "4D.WAV", 50) == BUZZER_UPLOAD_NO_ACK);
+    // - the channel is closed before the commit, with a file open.
+    HOST_CHECK(buzzer_bank_abort(b) == 4);
+    HOST_CHECK(fs.files == c.old && fs.open.empty());
+    HOST_CHECK(fs.n_refresh == 0 && fs.n_untaken == 0);
+    HOST_CHECK(commit(b) == BUZZER_UPLOAD_E_FORMAT);
+
+    // - the card was removed: nothing to write, the bank is dropped.
+    HOST_CHECK(upload(b, "1A.WAV", c.files[0].second, 100) ==
+               BUZZER_UPLOAD_OK);
+    fs.present = false;
+    HOST_CHECK(commit(b) == BUZZER_UPLOAD_E_CARD);
+    HOST_CHECK(buzzer_bank_abort(b) == 1 && b.n_files == 0);
+}
+
+
+static void test_rollback() {
+    host_test_rand rand = {0x4011};
+    auto c = make_case(rand);
+    // - the moves of a successful commit.
+    fake_fs ok;
+    ok.files = c.old;
+    buzzer_bank<fake_fs> b;
+    buzzer_bank_init(b, &ok);
+    for (const auto& [name, data] : c.files) {upload(b, name, data, 300);}
+    HOST_CHECK(commit(b) == BUZZER_UPLOAD_OK);
+    HOST_CHECK(ok.n_moves == 5);
+
+    for (int k = 0; k < ok.n_moves; k++) {
+        fake_fs fs;
+        fs.files = c.old;
+        buzzer_bank_init(b, &fs);
+        for (const auto& [name, data] : c.files) {
+            HOST_CHECK(upload(b, name, data, 300) == BUZZER_UPLOAD_OK);
+        }
+        fs.fail_move = fs.n_moves + k;
+        HOST_CHECK(commit(b) == BUZZER_UPLOAD_E_CARD);
+        // - the old files are back, nothing is left, no refresh.
+        HOST_CHECK(fs.files == c.old);
+        HOST_CHECK(fs.n_refresh == 0 && !fs.taken && fs.n_untaken == 0);
+    }
+}
+
+
+/// random SDUs, and the card removed at random.
+static void test_random_sdus() {
+    host_test_rand rand = {0x5d05};
+    const disk old = {{"1A.WAV", {1, 2, 3}}, {"2B.WAV", {4, 5}}};
+    fake_fs fs;
+    fs.files = old;
+    buzzer_bank<fake_fs> b;
+    buzzer_bank_init(b, &fs);
+    const char* names[] = {"1A.WAV", "2B.WAV", "3C.WAV", "0.WAV"};
+    int n_commits = 0;
+    for (int k = 0; k < 20000; k++) {
+        fs.present = rand() % 50 != 0;
+        fs.fail_move = rand() % 10 == 0 ? fs.n_moves + rand() % 4 : -1;
+        uint8_t sdu[24] = {};
+        int len = 1 + rand() % sizeof(sdu);
+        for (int i = 0; i < len; i++) {sdu[i] = rand();}
+        sdu[0] = 1 + rand() % 5;
+        if (sdu[0] == BUZZER_UPLOAD_BEGIN) {
+            auto name = names[rand() % 4];
+            uint32_t size = rand() % 40;
+            memcpy(&sdu[1], &size, 4);
+            strcpy((char*)&sdu[5], name);
+            len = 5 + strlen(name) + 1;
+        } else if (sdu[0] == BUZZER_UPLOAD_COMMIT) {
+            n_commits += commit(b) == BUZZER_UPLOAD_OK ? 1 : 0;
+            HOST_CHECK(b.n_files > 0 || !temporary(fs.files));
+            continue;
+        } else if (sdu[0] == BUZZER_UPLOAD_DATA && b.open && rand() % 2) {
+            // - up to the end of the file.
+            const auto& file = b.files[b.n_files - 1];
+            len = 1 + std::min<int>(file.size - file.received,
+                                    sizeof(sdu) - 1);
+        } else if (sdu[0] == BUZZER_UPLOAD_END && rand() % 4) {
+            len = 5;
+            if (b.open) {memcpy(&sdu[1], &b.files[b.n_files - 1].crc, 4);}
+        }
+        auto status = buzzer_bank_feed(b, sdu, len);
+        HOST_CHECK(status != BUZZER_UPLOAD_OK || sdu[0] == BUZZER_UPLOAD_END);
+        HOST_CHECK(b.n_files >= 0 && b.n_files <= BUZZER_SOUNDS);
+        HOST_CHECK(!fs.taken);
+        if (rand() % 200 == 0) {
+            fs.present = true;
+            buzzer_bank_abort(b);
+            HOST_CHECK(!temporary(fs.files) && fs.open.empty());
+        }
+    }
+    fs.present = true;
+    buzzer_bank_abort(b);
+    HOST_CHECK(!temporary(fs.files));
+    HOST_CHECK(fs.n_untaken == 0 && fs.n_refresh == n_commits);
+    std::printf("bank: %d random commits\n", n_commits);
+}
+
+
+int main() {
+    test_commit();
+    test_broken();
+    test_closed();
+    test_rollback();
+    test_random_sdus();
+    return host_test_result("bank");
+}
@@ -0,0 +1,162 @@
+/** @file test_clip.cpp
+ *
+ * Home Buzzer - host tests of the raw sectors of the sound files
+ * ==========================================
+ *
+ * random files are stored to a fake FAT volume by random cluster maps,
+ * the contiguous ones are read back by the card sectors, the fragmented
+ * and the unaligned ones fall back to the file, and all are the same
+ * as written.
+ */
+#include <stdint.h>
+#include <vector>
+
+#include "buzzer_clip.h"
+#include "host_test.h"
+
+
+static constexpr int frame = 2048;  // - `BUZZER_BYTES_FRAME`
+
+/// fragments of a file: {n_clusters, first cluster}.
+using fragments = std::vector<std::pair<uint32_t, uint32_t>>;
+
+
+/// the link map of FATFS by a table of `n_clmt` items.
+static std::vector<uint32_t> linkmap(const fragments& frags, int n_clmt) {
+    std::vector<uint32_t> ret(n_clmt, 0);
+    uint32_t n_items = 2 * frags.size() + 2;
+    ret[0] = n_items;
+    if ((int)n_items > n_clmt) {return ret;}
+    int i = 1;
+    for (auto [n, cl] : frags) {
+        ret[i++] = n;
+        ret[i++] = cl;
+    }
+    ret[i] = 0;
+    return ret;
+}
+
+
+static uint64_t cluster_ofs(const buzzer_clip_fs& fs, uint32_t cl) {
+    return (fs.database + fs.csize * (uint64_t)(cl - 2)) * fs.fs_ssize;
+}
+
+
+/// read the clip by the card sectors, as `buzzer_src_read()`.
+static std::vector<uint8_t> read_raw(const std::vector<uint8_t>& disk,
+                                     uint32_t card_ssize, uint32_t sector,
+                                     uint32_t remain) {
+    std::vector<uint8_t> ret;
+    std::vector<uint8_t> buf(frame);
+    while (remain > 0) {
+        auto [n, n_sectors] = buzzer_clip_next(remain, frame, card_ssize);
+        HOST_CHECK(n_sectors * card_ssize <= (uint32_t)frame);
+        uint64_t ofs = (uint64_t)sector * card_ssize;
+        HOST_CHECK(ofs + n_sectors * card_ssize <= disk.size());
+        std::copy(disk.begin() + ofs,
+                  disk.begin() + ofs + n_sectors * card_ssize, buf.begin());
+        ret.insert(ret.end(), buf.begin(), buf.begin() + n);
+        sector += n_sectors;
+        remain -= n;
+    }
+    return ret;
+}
+
+
+/// read the clip by the clusters, as FATFS for the file fallback.
+static std::vector<uint8_t> read_file(const std::vector<uint8_t>& disk,
+                                      const buzzer_clip_fs& fs,
+                                      const fragments& frags,
+                                      uint32_t n_bytes) {
+    std::vector<uint8_t> ret;
+    const uint32_t n_cluster = fs.csize * fs.fs_ssize;
+    for (auto [n, cl] : frags) {
+        for (uint32_t i = 0; i < n && ret.size() < n_bytes; i++) {
+            auto ofs = cluster_ofs(fs, cl + i);
+            auto len = std::min<uint32_t>(n_cluster, n_bytes - ret.size());
+            ret.insert(ret.end(), disk.begin() + ofs, disk.begin() + ofs + len);
+        }
+    }
+    return ret;
+}
+
+
+static void test_random_maps() {
+    host_test_rand rand = {0xc1a9};
+    int n_raw = 0, n_fragmented = 0, n_unaligned = 0;
+    for (int k = 0; k < 300; k++) {
+        buzzer_clip_fs fs = {};
+        fs.fs_ssize = rand() % 4 ? 512 : 4096;
+        fs.card_ssize = rand() % 4 ? 512 : 4096;
+        fs.csize = 1u << (rand() % 4);
+        fs.database = 32 + rand() % 64;
+        const uint32_t n_cluster = fs.csize * fs.fs_ssize;
+
+        uint32_t n_bytes = 1 + rand() % 40000;
+        uint32_t n_clusters = (n_bytes + n_cluster - 1) / n_cluster;
+        // - split to random fragments, with the gaps between them.
+        fragments frags;
+        uint32_t cl = 2 + rand() % 8;
+        for (uint32_t left = n_clusters; left > 0;) {
+            uint32_t n = rand() % 3 ? left : 1 + rand() % left;
+            frags.push_back({n, cl});
+            cl += n + 1 + rand() % 4;
+            left -= n;
+        }
+        std::vector<uint8_t> disk(cluster_ofs(fs, cl) + n_cluster);
+        std::vector<uint8_t> data(n_bytes);
+        for (auto& v : data) {v = rand();}
+        uint32_t pos = 0;
+        for (auto [n, c] : frags) {
+            for (uint32_t i = 0; i < n && pos < n_bytes; i++) {
+                auto ofs = cluster_ofs(fs, c + i);
+                auto len = std::min(n_cluster, n_bytes - pos);
+                std::copy(data.begin() + pos, data.begin() + pos + len,
+                          disk.begin() + ofs);
+                pos += len;
+            }
+        }
+
+        auto clmt = linkmap(frags, 4);
+        auto cluster = buzzer_clip_cluster(clmt.data(), clmt.size());
+        HOST_CHECK((cluster != 0) == (frags.size() == 1));
+        auto sector = buzzer_clip_sector(fs, cluster, frame);
+        bool aligned = cluster_ofs(fs, frags[0].second) % fs.card_ssize == 0 &&
+                       frame % fs.card_ssize == 0;
+        HOST_CHECK((sector != 0) == (frags.size() == 1 && aligned));
+
+        if (sector != 0) {
+            n_raw++;
+            HOST_CHECK(read_raw(disk, fs.card_ssize, sector, n_bytes) == data);
+        } else {
+            frags.size() > 1 ? n_fragmented++ : n_unaligned++;
+            HOST_CHECK(read_file(disk, fs, frags, n_bytes) == data);
+        }
+    }
+    HOST_CHECK(n_raw > 0 && n_fragmented > 0 && n_unaligned > 0);
+    std::printf("clip: %d raw, %d fragmented, %d unaligned\n",
+                n_raw, n_fragmented, n_unaligned);
+}
+
+
+/// a map of three fragments does not fit the table of one fragment.
+static void test_fragmented_map() {
+    const fragments frags = {{3, 10}, {2, 20}, {1, 30}};
+    for (int n_clmt = 4; n_clmt <= 8; n_clmt++) {
+        auto clmt = linkmap(frags, n_clmt);
+        HOST_CHECK(clmt[0] == 8);
+        HOST_CHECK(buzzer_clip_cluster(clmt.data(), n_clmt) == 0);
+    }
+    auto one = linkmap({{6, 10}}, 4);
+    HOST_CHECK(buzzer_clip_cluster(one.data(), 4) == 10);
+    // - the lseek failed before the map was written.
+    const uint32_t empty[4] = {4, 0, 0, 0};
+    HOST_CHECK(buzzer_clip_cluster(empty, 4) == 0);
+}
+
+
+int main() {
+    test_random_maps();
+    test_fragmented_map();
+    return host_test_result("clip");
+}
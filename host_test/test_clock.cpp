@@ -0,0 +1,58 @@
+/** @file test_clock.cpp
+ *
+ * Home Buzzer - host tests of the hub clock estimation
+ * ==========================================
+ *
+ * receivers with random scan delays agree on the start time within
+ * the spread of their estimations, across the wraps and the restarts
+ * of the hub clock.
+ */
+#include <stdint.h>
+
+#include "buzzer_clock.h"
+#include "host_test.h"
+
+using buzzer_clock_check::simulate;
+
+
+static void test_random_receivers() {
+    host_test_rand rand = {0x5eed};
+    for (int i = 0; i < 500; i++) {
+        int delay_ms = 1 + rand() % 200;
+        uint16_t hub0 = rand();
+        auto r = simulate(20 + rand() % 60, delay_ms, hub0, 1000, rand());
+        HOST_CHECK(r.resets == 0);
+        HOST_CHECK(r.skew <= r.spread + 1000);
+    }
+}
+
+
+static void test_hub_restart() {
+    host_test_rand rand = {0xbadc10c};
+    for (int i = 0; i < 500; i++) {
+        int delay_ms = 1 + rand() % 200;
+        uint16_t hub0 = 3000 + rand() % 60000;
+        int reset_at = 1 + rand() % 40;
+        // - a restart within the scan delays is not seen as a jump.
+        int16_t jump = 100 - (uint16_t)(hub0 + reset_at * 100);
+        if (jump > -BUZZER_CLOCK_RESET_MSEC - delay_ms &&
+                jump < BUZZER_CLOCK_RESET_MSEC + delay_ms) {
+            continue;
+        }
+        // - right after the restart, and after a full window.
+        auto r = simulate(reset_at + 1, delay_ms, hub0, reset_at, rand());
+        HOST_CHECK(r.resets == 8);
+        HOST_CHECK(r.skew <= delay_ms * 1000 + 1000);
+        r = simulate(reset_at + 1 + BUZZER_CLOCK_SAMPLES, delay_ms, hub0,
+                     reset_at, rand());
+        HOST_CHECK(r.resets == 8);
+        HOST_CHECK(r.skew <= r.spread + 1000);
+    }
+}
+
+
+int main() {
+    test_random_receivers();
+    test_hub_restart();
+    return host_test_result("clock");
+}
@@ -0,0 +1,93 @@
+/** @file test_dac.cpp
+ *
+ * Home Buzzer - host tests of the DAC packing
+ * ==========================================
+ *
+ * random sounds packed by random DMA block sizes are the same as
+ * packed at once, the stereo output alternates the channels and
+ * the filtered channels are packed as the decoded ones.
+ */
+#include <stdint.h>
+#include <vector>
+
+#include "buzzer_dac.h"
+#include "host_test.h"
+
+
+static std::vector<uint8_t> pack(const std::vector<int8_t>& src, int n_bits,
+                                 bool streao, int volume, bool stereo_out,
+                                 host_test_rand* rand) {
+    std::vector<uint8_t> ret(src.size() * 2 + 2);
+    int n = 0, m = 0;
+    while (n < (int)src.size()) {
+        int n_dst = rand ? 2 + (*rand)() % 64 : (int)ret.size() - m;
+        auto [n_src, n_out] = buzzer_dac_pack(
+                src.data() + n, src.size() - n, n_bits, streao, volume,
+                stereo_out, ret.data() + m, n_dst);
+        HOST_CHECK(n_src > 0 && n_out <= n_dst);
+        n += n_src;
+        m += n_out;
+    }
+    HOST_CHECK(n == (int)src.size());
+    ret.resize(m);
+    return ret;
+}
+
+
+static void test_random_blocks() {
+    host_test_rand rand = {0xdac};
+    for (int i = 0; i < 500; i++) {
+        int n_bits = rand() % 2 ? 16 : 8;
+        bool streao = rand() % 2;
+        bool stereo_out = rand() % 2;
+        int volume = 1 + rand() % 256;
+        int frame = (n_bits / 8) * (streao ? 2 : 1);
+        int n_frames = 1 + rand() % 300;
+        std::vector<int8_t> src(n_frames * frame);
+        for (auto& v : src) {v = rand();}
+
+        auto once = pack(src, n_bits, streao, volume, stereo_out, nullptr);
+        auto blocks = pack(src, n_bits, streao, volume, stereo_out, &rand);
+        HOST_CHECK(once == blocks);
+        HOST_CHECK((int)once.size() == n_frames * (stereo_out ? 2 : 1));
+        for (auto v : once) {HOST_CHECK(v >= 22 && v <= 106);}
+        // - a mono sound is the same in both channels.
+        if (stereo_out && !streao) {
+            for (int j = 0; j < n_frames; j++) {
+                HOST_CHECK(once[j * 2] == once[j * 2 + 1]);
+            }
+        }
+    }
+}
+
+
+static void test_planar() {
+    host_test_rand rand = {0x16};
+    for (int i = 0; i < 200; i++) {
+        int n = 1 + rand() % 256;
+        int volume = 1 + rand() % 256;
+        std::vector<int16_t> l(n), r(n);
+        std::vector<int8_t> src(n * 4);
+        for (int j = 0; j < n; j++) {
+            l[j] = rand();
+            r[j] = rand();
+            src[j * 4] = l[j] & 0xFF;
+            src[j * 4 + 1] = l[j] >> 8;
+            src[j * 4 + 2] = r[j] & 0xFF;
+            src[j * 4 + 3] = r[j] >> 8;
+        }
+        std::vector<uint8_t> dst(n * 2);
+        auto m = buzzer_dac_pack16(l.data(), r.data(), n, volume, true,
+                                   dst.data());
+        HOST_CHECK(m == n * 2);
+        dst.resize(m);
+        HOST_CHECK(dst == pack(src, 16, true, volume, true, nullptr));
+    }
+}
+
+
+int main() {
+    test_random_blocks();
+    test_planar();
+    return host_test_result("dac");
+}
@@ -0,0 +1,92 @@
+/** @file test_eq.cpp
+ *
+ * Home Buzzer - host tests of the speaker compensation filter
+ * ==========================================
+ *
+ * the response of the quantized coefficients at all rates:
+ * the lows are cut, and no band is boosted over the presence peak.
+ * the fixed-point filter has the same response for the tones, and is
+ * timed per sample against the period of 44.1 kHz.
+ */
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+#include "buzzer_eq.h"
+#include "host_test.h"
+
+
+static void test_response() {
+    for (int i = 0; i < BUZZER_EQ_RATES; i++) {
+        auto rate = buzzer_eq_rates[i];
+        const auto& coefs = buzzer_eq_table[i];
+        HOST_CHECK(buzzer_eq_check::stable(coefs));
+        HOST_CHECK(buzzer_eq_check::gain_db(coefs, rate, 60) < -24);
+        HOST_CHECK(buzzer_eq_check::gain_db(coefs, rate, 100) < -12);
+        // - the high-pass falls monotonic below the corner.
+        double last = -200;
+        for (int hz = 20; hz < 300; hz += 10) {
+            auto db = buzzer_eq_check::gain_db(coefs, rate, hz);
+            HOST_CHECK(db > last);
+            last = db;
+        }
+        for (int hz = 400; hz < rate * 45 / 100; hz += 50) {
+            HOST_CHECK(buzzer_eq_check::gain_db(coefs, rate, hz) < 6);
+        }
+    }
+    HOST_CHECK(buzzer_eq_find(44100) == &buzzer_eq_table[5]);
+    HOST_CHECK(buzzer_eq_find(8001) == nullptr);
+}
+
+
+/// the gain of the filtered tones, after the settling, as designed.
+static void test_process() {
+    for (int i = 0; i < BUZZER_EQ_RATES; i++) {
+        auto rate = buzzer_eq_rates[i];
+        for (int hz : {300, 1000, 3000}) {
+            if (hz * 2 >= rate * 45 / 100) {continue;}
+            std::vector<int16_t> buf(rate / 2);
+            for (int j = 0; j < (int)buf.size(); j++) {
+                buf[j] = (int16_t)(4000 * std::sin(2 * M_PI * hz * j / rate));
+            }
+            buzzer_biquad_state states[BUZZER_EQ_BANDS] = {};
+            buzzer_eq_process(buzzer_eq_table[i], states, buf.data(),
+                              buf.size());
+            double sum = 0;
+            const int n = rate / 4;
+            for (int j = buf.size() - n; j < (int)buf.size(); j++) {
+                sum += (double)buf[j] * buf[j];
+            }
+            auto db = 20 * std::log10(std::sqrt(sum / n) / (4000 / M_SQRT2));
+            auto expect = buzzer_eq_check::gain_db(buzzer_eq_table[i],
+                                                   rate, hz);
+            HOST_CHECK(std::fabs(db - expect) < 0.5);
+        }
+    }
+}
+
+
+static void bench_process() {
+    const int rate = 44100;
+    const auto coefs = buzzer_eq_find(rate);
+    buzzer_biquad_state states[BUZZER_EQ_BANDS] = {};
+    int16_t buf[BUZZER_EQ_BLOCK];
+    host_test_rand rand = {0x1234567};
+    for (auto& v : buf) {v = (int16_t)rand() / 2;}
+    auto ns = host_test_nsec(5, 1000, [&] () {
+        buzzer_eq_process(*coefs, states, buf, BUZZER_EQ_BLOCK);
+    }) / BUZZER_EQ_BLOCK;
+    const double period = 1e9 / rate;
+    std::printf("eq: %d bands, %.2f nsec/sample, %.3f%% of %.0f nsec "
+                "at %d Hz\n", BUZZER_EQ_BANDS, ns, ns * 100 / period,
+                period, rate);
+    HOST_CHECK(ns < period);
+}
+
+
+int main() {
+    test_response();
+    test_process();
+    bench_process();
+    return host_test_result("eq");
+}
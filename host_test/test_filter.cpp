@@ -0,0 +1,276 @@
+/** @file test_filter.cpp
+ *
+ * Home Buzzer - host tests of the advertisement filter order
+ * ==========================================
+ *
+ * random stats are sorted into an order with each stage once,
+ * after its dependencies, and the skipped stages left out.
+ *
+ * the advertisements of common devices, in their on-air bytes, pass the
+ * stages of `buzzer_filter_pass()`: only the ones from the hub are
+ * charged to the rate buckets, the order sorted from the measured stats
+ * keeps the dependencies, and the nsec per rejected advertisement are
+ * reported for the fixed and the sorted order.
+ */
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include "buzzer_adv.h"
+#include "buzzer_filter.h"
+#include "host_test.h"
+
+
+constexpr uint8_t ADV_IND = 0, NONCONN_IND = 3;  /// HCI event types
+constexpr uint16_t ALERT_UUID = 0x1811;
+constexpr uint8_t TARGET = 1;
+
+struct fixture_adv {
+    const char* name;
+    uint8_t event_type;
+    uint8_t addr;       /// the last byte, the hub is 0x01
+    int weight;         /// in 100 advertisements
+    std::vector<uint8_t> data;
+};
+
+static const fixture_adv fixtures[] = {
+    {"ibeacon", NONCONN_IND, 0x10, 25, {
+        0x02, 0x01, 0x06,
+        0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15,
+        0xe2, 0xc5, 0x6d, 0xb5, 0xdf, 0xfb, 0x48, 0xd2,
+        0xb0, 0x60, 0xd0, 0xf5, 0xa7, 0x10, 0x96, 0xe0,
+        0x00, 0x01, 0x00, 0x02, 0xc5}},
+    {"apple-nearby", ADV_IND, 0x11, 30, {
+        0x02, 0x01, 0x1a,
+        0x0a, 0xff, 0x4c, 0x00, 0x10, 0x05, 0x01, 0x18, 0x2c, 0x7a, 0x9e}},
+    {"eddystone-uid", NONCONN_IND, 0x12, 10, {
+        0x02, 0x01, 0x06,
+        0x03, 0x03, 0xaa, 0xfe,
+        0x17, 0x16, 0xaa, 0xfe, 0x00, 0xe7,
+        0xed, 0xd1, 0xeb, 0xea, 0xc0, 0x4e, 0x5d, 0xef, 0xa0, 0x17,
+        0x0b, 0xad, 0xc0, 0xde, 0x00, 0x01, 0x00, 0x00}},
+    {"fast-pair", ADV_IND, 0x13, 5, {
+        0x02, 0x01, 0x06,
+        0x03, 0x03, 0x2c, 0xfe,
+        0x06, 0x16, 0x2c, 0xfe, 0x00, 0xb7, 0x27}},
+    {"swift-pair", ADV_IND, 0x14, 5, {
+        0x02, 0x01, 0x06,
+        0x06, 0xff, 0x06, 0x00, 0x03, 0x00, 0x80}},
+    {"ms-cdp", NONCONN_IND, 0x15, 10, {
+        0x1e, 0xff, 0x06, 0x00, 0x01, 0x09, 0x20, 0x02,
+        0x6b, 0x2e, 0x47, 0x91, 0x3a, 0xc4, 0x0d, 0x55, 0x81, 0x7f, 0x12,
+        0x9c, 0xe3, 0x28, 0x64, 0xb0, 0x1d, 0x4a, 0xf6, 0x39, 0x87, 0x5e,
+        0x02}},
+    {"heart-rate", ADV_IND, 0x16, 5, {
+        0x02, 0x01, 0x06,
+        0x03, 0x03, 0x0d, 0x18,
+        0x09, 0x09, 'H', 'R', 'M', '-', '1', '2', '3', '4'}},
+    {"other-ans", ADV_IND, 0x17, 3, {
+        0x02, 0x01, 0x06,
+        0x03, 0x03, 0x11, 0x18}},
+    // - repeats of a timed batch for this buzzer, and one for the others.
+    {"hub", ADV_IND, 0x01, 6, {
+        0x02, 0x01, 0x06,
+        0x05, 0x03, 0x0f, 0x18, 0x11, 0x18,
+        0x0f, 0xff, 0xff, 0xff, BUZZER_ADV_BATCH_V2, 0x07, 0x00,
+        0x10, 0x27, 0x2c, 0x28, 1, TARGET, 5, 0, 255}},
+    {"hub-others", ADV_IND, 0x01, 1, {
+        0x02, 0x01, 0x06,
+        0x05, 0x03, 0x0f, 0x18, 0x11, 0x18,
+        0x0b, 0xff, 0xff, 0xff, BUZZER_ADV_BATCH_V1, 0x08, 0x00,
+        1, TARGET + 1, 6, 0, 255}},
+};
+
+
+/// the parts of the device for `buzzer_filter_pass()`.
+struct fixture_env {
+    bool timed;     /// the stats by nsec, or none for the benchmark
+
+    int64_t now() {return 1;}
+
+    uint32_t cycles() {
+        if (!timed) {return 0;}
+        auto t = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+    }
+
+    bool addr(const uint8_t* addr) {
+        return addr[0] != 0x01 || addr[5] != 0xC0;
+    }
+
+    const char* payload(buzzer_filter_adv& adv) {
+        return adv.rec.sound >= 0 ? "sound" : nullptr;
+    }
+
+    void trace(buzzer_filter_stage, const buzzer_filter_adv&, bool, int) {}
+};
+
+
+/// a scan of the fixtures in a random order, an advertisement per msec.
+struct fixture_scan {
+    buzzer_filter filter;
+    fixture_env env;
+    host_test_rand rand;
+    int64_t usec;
+    int n_accepted;
+    int n_rejected;
+
+    const fixture_adv& next() {
+        int w = rand() % 100;
+        const fixture_adv* adv = &fixtures[0];
+        for (auto& f : fixtures) {
+            adv = &f;
+            if ((w -= f.weight) < 0) {break;}
+        }
+        return *adv;
+    }
+
+    void run(const fixture_adv& f) {
+        const uint8_t addr[6] = {f.addr, 0, 0, 0, 0, 0xC0};
+        usec += 1000;
+        auto adv = buzzer_filter_adv_of(f.event_type, addr, f.data.data(),
+                                        f.data.size(), usec);
+        if (buzzer_filter_pass(filter, adv, env)) {
+            n_accepted++;
+        } else {
+            n_rejected++;
+        }
+    }
+};
+
+
+static fixture_scan make_scan(uint8_t skip, bool reorder, bool timed) {
+    fixture_scan ret = {};
+    buzzer_filter_init(ret.filter, skip, reorder, TARGET, 20, 20);
+    ret.env = {timed};
+    ret.rand = {0xad5};
+    return ret;
+}
+
+
+/// the stages are in the order of the dependencies.
+static void check_order(const buzzer_filter_order& order, uint8_t skip) {
+    uint8_t done = skip;
+    for (int i = 0; i < order.n; i++) {
+        auto stage = order.stages[i];
+        HOST_CHECK((buzzer_filter_deps[stage] & ~done) == 0);
+        done |= 1 << stage;
+    }
+    HOST_CHECK(done == (1 << BUZZER_FILTER_STAGES) - 1);
+    int n = order.n;
+    HOST_CHECK(order.stages[n - 3] == BUZZER_FILTER_RATE);
+    HOST_CHECK(order.stages[n - 2] == BUZZER_FILTER_PAYLOAD);
+    HOST_CHECK(order.stages[n - 1] == BUZZER_FILTER_HISTORY);
+}
+
+
+static void test_fixtures() {
+    int weights = 0;
+    for (auto& f : fixtures) {
+        weights += f.weight;
+        int len = f.data.size();
+        HOST_CHECK(len <= 31);
+        HOST_CHECK(buzzer_adv_uuid16(f.data.data(), len, ALERT_UUID) !=
+                   BUZZER_ADV_MALFORMED);
+    }
+    HOST_CHECK(weights == 100);
+
+    for (uint8_t skip : {0, 1 << BUZZER_FILTER_ADDR}) {
+        // - only the connectable ones with the service (from the hub, if
+        //   the address is configured) are charged to the buckets.
+        auto scan = make_scan(skip, false, false);
+        int n_charged = 0;
+        for (int i = 0; i < BUZZER_FILTER_PERIOD - 1; i++) {
+            auto& f = scan.next();
+            n_charged += f.event_type == ADV_IND &&
+                         (skip || f.addr == 0x01) &&
+                         buzzer_adv_uuid16(f.data.data(), f.data.size(),
+                                           ALERT_UUID) >= 0;
+            scan.run(f);
+        }
+        HOST_CHECK((int)scan.filter.stats.runs[BUZZER_FILTER_RATE] ==
+                   n_charged);
+        HOST_CHECK(scan.n_accepted == 1);
+
+        // - the order settles by the measured stats, and stays.
+        scan = make_scan(skip, true, true);
+        for (int i = 0; i < 3 * BUZZER_FILTER_PERIOD; i++) {
+            scan.run(scan.next());
+        }
+        check_order(scan.filter.order, skip);
+        HOST_CHECK(scan.n_accepted == 1);
+    }
+}
+
+
+/// nsec per rejected advertisement, by the fixed and the sorted order.
+static void bench_rejects() {
+    for (uint8_t skip : {0, 1 << BUZZER_FILTER_ADDR}) {
+        auto sorted = make_scan(skip, true, true);
+        for (int i = 0; i < 3 * BUZZER_FILTER_PERIOD; i++) {
+            sorted.run(sorted.next());
+        }
+        sorted.filter.reorder = false;
+        sorted.env.timed = false;
+        auto fixed = make_scan(skip, false, false);
+
+        double ns[2] = {};
+        int i = 0;
+        for (auto scan : {&fixed, &sorted}) {
+            std::vector<const fixture_adv*> advs;
+            for (int j = 0; j < 4096; j++) {advs.push_back(&scan->next());}
+            size_t k = 0;
+            scan->n_rejected = 0;
+            auto per_call = host_test_nsec(5, advs.size(), [&] () {
+                scan->run(*advs[k++ % advs.size()]);
+            });
+            double per_reject = (double)scan->n_rejected / (5 * advs.size());
+            ns[i++] = per_call / per_reject;
+        }
+        std::printf("filter: %s %.1f nsec/reject fixed, %.1f sorted (",
+                    skip ? "ADDR_ANY" : "addr", ns[0], ns[1]);
+        for (int j = 0; j < sorted.filter.order.n; j++) {
+            std::printf("%s%s", j ? " " : "",
+                        buzzer_filter_names[sorted.filter.order.stages[j]]);
+        }
+        std::printf(")\n");
+    }
+}
+
+
+static void test_random_stats() {
+    host_test_rand rand = {0x1234567};
+    for (int i = 0; i < 100000; i++) {
+        buzzer_filter_stats s{};
+        for (int j = 0; j < BUZZER_FILTER_STAGES; j++) {
+            s.runs[j] = rand() % 2048;
+            s.rejects[j] = s.runs[j] > 0 ? rand() % (s.runs[j] + 1) : 0;
+            s.cycles[j] = (uint64_t)s.runs[j] * (rand() % 10000);
+        }
+        uint8_t skip = rand() % 2 ? 1 << BUZZER_FILTER_ADDR : 0;
+        auto order = buzzer_filter_sort(s, skip);
+
+        uint8_t done = 0;
+        for (int j = 0; j < order.n; j++) {
+            auto stage = order.stages[j];
+            HOST_CHECK(!(done & (1 << stage)));
+            HOST_CHECK(!(skip & (1 << stage)));
+            HOST_CHECK((buzzer_filter_deps[stage] & ~(done | skip)) == 0);
+            done |= 1 << stage;
+        }
+        HOST_CHECK((done | skip) == (1 << BUZZER_FILTER_STAGES) - 1);
+
+        buzzer_filter_decay(s);
+        for (int j = 0; j < BUZZER_FILTER_STAGES; j++) {
+            HOST_CHECK(s.rejects[j] <= s.runs[j] + 1);
+        }
+    }
+}
+
+
+int main() {
+    test_random_stats();
+    test_fixtures();
+    bench_rejects();
+    return host_test_result("filter");
+}
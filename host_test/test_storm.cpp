@@ -0,0 +1,118 @@
+/** @file test_storm.cpp
+ *
+ * Home Buzzer - host tests of the advertisement storm
+ * ==========================================
+ *
+ * the storm of `buzzer_storm.h` through `buzzer_filter_pass()`, at 50000
+ * and 5000 advertisements/sec:
+ *
+ * - each sender passes the rate limit at most by the burst and the rate,
+ *   the rotating addresses share one bucket once the table is full.
+ * - the payload stage (the decode and the hub clock) runs at most by
+ *   the rate of the table and the overflow bucket.
+ * - the throughput, the p99 handling time and the nsec per rejected
+ *   advertisement are reported.
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "buzzer_storm.h"
+#include "host_test.h"
+
+
+constexpr int RATE = 20, BURST = 20;   /// defaults of the menuconfig
+
+/// the parts of the device, counts the advertisements within the rate.
+struct storm_env {
+    std::map<uint64_t, int> passed;     /// by the address
+    int n_payloads = 0;
+
+    int64_t now() {return 1;}
+
+    uint32_t cycles() {
+        auto t = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+    }
+
+    bool addr(const uint8_t*) {return false;}
+
+    const char* payload(buzzer_filter_adv& adv) {
+        n_payloads++;
+        return adv.rec.sound >= 0 && adv.rec.sound < BUZZER_SOUNDS ? "sound"
+                                                                   : nullptr;
+    }
+
+    void trace(buzzer_filter_stage stage, const buzzer_filter_adv& adv,
+               bool rejected, int) {
+        if (stage != BUZZER_FILTER_RATE || rejected) {return;}
+        uint64_t key = 0;
+        for (int i = 0; i < 6; i++) {key |= (uint64_t)adv.addr[i] << (8 * i);}
+        passed[key]++;
+    }
+};
+
+
+/// replay `n` advertisements of the storm at `per_sec`.
+static void test_storm(int n, int per_sec) {
+    buzzer_filter filter;
+    buzzer_filter_init(filter, 1 << BUZZER_FILTER_ADDR, true, 1, RATE, BURST);
+    storm_env env;
+    buzzer_storm storm;
+    buzzer_storm_init(storm, 0x1234567);
+
+    std::vector<double> ns(n);
+    double ns_rejected = 0;
+    int n_rejected = 0;
+    for (int i = 0; i < n; i++) {
+        buzzer_storm_next(storm, i);
+        auto adv = buzzer_filter_adv_of(storm.event_type, storm.addr,
+                                        storm.data, storm.len,
+                                        1 + i * 1000000LL / per_sec);
+        auto t = std::chrono::steady_clock::now();
+        auto accepted = buzzer_filter_pass(filter, adv, env);
+        std::chrono::duration<double, std::nano> d =
+            std::chrono::steady_clock::now() - t;
+        ns[i] = d.count();
+        if (!accepted) {
+            ns_rejected += d.count();
+            n_rejected++;
+        }
+    }
+
+    // - the bucket of a sender, or the overflow shared by the others.
+    const double sec = (double)n / per_sec;
+    const int per_bucket = BURST + (int)(RATE * sec) + 1;
+    int n_senders = 0, n_rotating = 0, n_passed = 0;
+    for (auto [key, count] : env.passed) {
+        uint8_t addr[6] = {};
+        for (int i = 0; i < 6; i++) {addr[i] = key >> (8 * i);}
+        HOST_CHECK(count <= per_bucket);
+        buzzer_storm_sender(addr) ? n_senders++ : n_rotating++;
+        n_passed += count;
+    }
+    HOST_CHECK(n_senders == BUZZER_STORM_SENDERS && n_rotating > 0);
+    HOST_CHECK(n_passed <= (BUZZER_RATE_SENDERS + 1) * per_bucket);
+    HOST_CHECK(env.n_payloads == n_passed);
+
+    double sum = 0;
+    for (auto v : ns) {sum += v;}
+    std::sort(ns.begin(), ns.end());
+    auto p99 = ns[n * 99 / 100];
+    // - tens of thousands of advertisements/sec, with a margin for
+    //   the sanitizers.
+    HOST_CHECK(n * 1e9 / sum > 50000);
+    std::printf("storm: %d advs at %d/s, %d within the rate (%d rotating "
+                "addresses), %.0f advs/s, p99 %.0f nsec, %.0f nsec/reject\n",
+                n, per_sec, n_passed, n_rotating, n * 1e9 / sum, p99,
+                n_rejected > 0 ? ns_rejected / n_rejected : 0);
+}
+
+
+int main() {
+    test_storm(50000, 50000);
+    test_storm(50000, 5000);
+    return host_test_result("storm");
+}
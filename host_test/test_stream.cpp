@@ -0,0 +1,57 @@
+/** @file test_stream.cpp
+ *
+ * Home Buzzer - host tests of the live stream
+ * ==========================================
+ *
+ * - the jitter buffer over many random traces.
+ * - the ADPCM decoder with random frames stays in range.
+ */
+#include <stdint.h>
+
+#include "buzzer_stream.h"
+#include "host_test.h"
+
+
+static void test_jitter_traces() {
+    using buzzer_stream_check::simulate;
+    uint32_t late = 0;
+    uint32_t concealed = 0;
+    const int n_seeds = 200;
+    for (uint32_t seed = 1; seed <= n_seeds; seed++) {
+        auto r = simulate(0, 0, seed);
+        HOST_CHECK(r.played == 200 && r.underruns == 0);
+
+        r = simulate(40, 0, seed);
+        HOST_CHECK(r.target > BUZZER_JITTER_MIN);
+        late += r.late;
+        concealed += r.concealed;
+
+        r = simulate(5, 20, seed);
+        HOST_CHECK(r.concealed == 9 && r.played == 190);
+    }
+    // - jitter up to 40 msec: less than 1% is late or concealed.
+    HOST_CHECK((late + concealed) * 100 < n_seeds * 200);
+}
+
+
+static void test_adpcm_random() {
+    host_test_rand rand = {0x1234567};
+    uint8_t frame[BUZZER_STREAM_ADPCM_BYTES];
+    int16_t pcm[BUZZER_STREAM_FRAME];
+    for (int i = 0; i < 10000; i++) {
+        for (auto& v : frame) {v = rand();}
+        buzzer_adpcm_decode(frame, pcm);
+        buzzer_adpcm s = {(int16_t)(frame[0] | (frame[1] << 8)), frame[2] % 89};
+        for (int j = 0; j < 4 * BUZZER_STREAM_FRAME; j++) {
+            buzzer_adpcm_decode1(s, rand() & 0xF);
+            HOST_CHECK(s.index >= 0 && s.index <= 88);
+        }
+    }
+}
+
+
+int main() {
+    test_jitter_traces();
+    test_adpcm_random();
+    return host_test_result("stream");
+}
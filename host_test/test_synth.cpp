@@ -0,0 +1,72 @@
+/** @file test_synth.cpp
+ *
+ * Home Buzzer - host tests of the tone synthesizer
+ * ==========================================
+ *
+ * random tones have the frequency of the note (by the zero crossings),
+ * and the notes end in silence.
+ * the renderer is timed per sample against the period of the DAC rate.
+ */
+#include <stdint.h>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "buzzer_synth.h"
+#include "host_test.h"
+
+
+static void test_random_tones() {
+    host_test_rand rand = {0x1234567};
+    for (int i = 0; i < 200; i++) {
+        uint16_t hz = 200 + rand() % 3800;
+        const buzzer_synth_note note = {hz, hz, 200, 0, 0};
+        buzzer_synth s{};
+        buzzer_synth_init(s, &note, 1);
+        std::vector<int16_t> buf(BUZZER_SYNTH_RATE);
+        int n = 0;
+        while (auto m = buzzer_synth_render(s, buf.data() + n, 100)) {n += m;}
+        HOST_CHECK(n == 200 * BUZZER_SYNTH_RATE / 1000);
+
+        auto crossings = buzzer_synth_check::crossings(buf.data(), n);
+        auto measured = crossings * (double)BUZZER_SYNTH_RATE / n / 2;
+        HOST_CHECK(measured > hz * 0.98 - 5 && measured < hz * 1.02 + 5);
+        // - the release brings the last sample to silence.
+        HOST_CHECK(buf[n - 1] > -1100 && buf[n - 1] < 1100);
+    }
+}
+
+
+static void bench_render() {
+    static const std::pair<const char*, const buzzer_synth_note*> notes[] = {
+        {"tone", buzzer_synth_check::tone},
+        {"sweep", buzzer_synth_check::sweep},
+        {"chime", buzzer_synth_check::chime},
+    };
+    const double period = 1e9 / BUZZER_SYNTH_RATE;
+    int16_t buf[BUZZER_BYTES_FRAME / sizeof(int16_t)];
+    for (auto [name, note] : notes) {
+        int n = 0;
+        auto ns = host_test_nsec(5, 100, [&] () {
+            buzzer_synth s{};
+            buzzer_synth_init(s, note, 1);
+            n = 0;
+            while (auto m = buzzer_synth_render(s, buf, std::size(buf))) {
+                n += m;
+            }
+        });
+        HOST_CHECK(n == 100 * BUZZER_SYNTH_RATE / 1000);
+        ns /= n;
+        std::printf("synth: %s %.2f nsec/sample, %.3f%% of %.0f nsec "
+                    "at %d Hz\n", name, ns, ns * 100 / period, period,
+                    BUZZER_SYNTH_RATE);
+        HOST_CHECK(ns < period);
+    }
+}
+
+
+int main() {
+    test_random_tones();
+    bench_render();
+    return host_test_result("synth");
+}
@@ -0,0 +1,190 @@
+/** @file buzzer_adv.h
+ *
+ * Home Buzzer - advertisement payload
+ * ==========================================
+ *
+ * manufacturer specific data, offsets from the company ID:
+ *
+ * legacy  | 0-1: company | 2: sound   | 3-4: seq |
+ * batch   | 0-1: company | 2: version | 3-4: seq | 5: count | 6-: records |
+ * timed   | 0-1: company | 2: version | 3-4: seq | 5-6: hub clock |
+ *         | 7-8: start time | 9: count | 10-: records |
+ * record  | 0: target | 1: sound | 2: priority | 3: volume |
+ *
+ * - legacy payloads have a sound index below `BUZZER_ADV_BATCH_V1`.
+ * - a batch is rejected as a whole if it is truncated or malformed.
+ * - target `BUZZER_ADV_TARGET_ALL` matches every buzzer.
+ * - if several records match, the highest priority wins.
+ * - timed batch (`BUZZER_ADV_BATCH_V2`) has the hub clock and the start
+ *   time in the hub clock (msec, wrap at 65536) to start all rooms at once.
+ *
+ * the AD structures of the advertisement are scanned in place
+ * (`buzzer_adv_field()`, `buzzer_adv_uuid16()`), without parsing all fields.
+ */
+#pragma once
+#include <stdint.h>
+#include <tuple>
+
+constexpr uint8_t BUZZER_ADV_BATCH_V1 = 0xB1;
+constexpr uint8_t BUZZER_ADV_BATCH_V2 = 0xB2;
+constexpr uint8_t BUZZER_ADV_TARGET_ALL = 0xFF;
+
+constexpr int BUZZER_ADV_OFS_SOUND = 2;
+constexpr int BUZZER_ADV_OFS_SEQ = 3;
+constexpr int BUZZER_ADV_OFS_COUNT = 5;
+constexpr int BUZZER_ADV_OFS_RECORDS = 6;
+constexpr int BUZZER_ADV_OFS_HUB_CLOCK = 5;
+constexpr int BUZZER_ADV_OFS_START = 7;
+constexpr int BUZZER_ADV_OFS_COUNT_V2 = 9;
+constexpr int BUZZER_ADV_RECORD_SIZE = 4;
+
+constexpr uint8_t BUZZER_ADV_AD_UUID16_INCOMP = 0x02;
+constexpr uint8_t BUZZER_ADV_AD_UUID16_COMP = 0x03;
+constexpr uint8_t BUZZER_ADV_AD_MFG_DATA = 0xFF;
+constexpr int BUZZER_ADV_MALFORMED = -2;
+
+struct buzzer_adv_rec {
+    int sound;          /// -1 if nothing for this buzzer
+    uint8_t priority;
+    uint8_t volume;     /// 255 for full scale
+    uint16_t seq;
+    bool timed;         /// `hub_msec` and `start_msec` are valid
+    uint16_t hub_msec;
+    uint16_t start_msec;
+};
+
+
+constexpr buzzer_adv_rec buzzer_adv_decode(
+        const uint8_t* src, int len, uint8_t target
+) {
+    buzzer_adv_rec ret = {-1, 0, 0, 0, false, 0, 0};
+    if (len <= BUZZER_ADV_OFS_SOUND) {return ret;}
+
+    auto ver = src[BUZZER_ADV_OFS_SOUND];
+    if (ver < BUZZER_ADV_BATCH_V1) {
+        ret.seq = (len > BUZZER_ADV_OFS_SEQ ? src[BUZZER_ADV_OFS_SEQ] : 0) |
+                  (len > BUZZER_ADV_OFS_SEQ + 1 ?
+                   src[BUZZER_ADV_OFS_SEQ + 1] << 8 : 0);
+        ret.sound = ver;
+        ret.priority = 0;
+        ret.volume = 255;
+        return ret;
+    }
+    if (ver != BUZZER_ADV_BATCH_V1 && ver != BUZZER_ADV_BATCH_V2) {
+        return ret;
+    }
+    auto timed = ver == BUZZER_ADV_BATCH_V2;
+    auto ofs_count = timed ? BUZZER_ADV_OFS_COUNT_V2 : BUZZER_ADV_OFS_COUNT;
+    if (len <= ofs_count) {return ret;}
+
+    int count = src[ofs_count];
+    if (count < 1) {return ret;}
+    if (len < ofs_count + 1 + count * BUZZER_ADV_RECORD_SIZE) {
+        return ret;
+    }
+    ret.seq = src[BUZZER_ADV_OFS_SEQ] | (src[BUZZER_ADV_OFS_SEQ + 1] << 8);
+    if (timed) {
+        ret.timed = true;
+        ret.hub_msec = src[BUZZER_ADV_OFS_HUB_CLOCK] |
+                       (src[BUZZER_ADV_OFS_HUB_CLOCK + 1] << 8);
+        ret.start_msec = src[BUZZER_ADV_OFS_START] |
+                         (src[BUZZER_ADV_OFS_START + 1] << 8);
+    }
+
+    auto rec = &src[ofs_count + 1];
+    for (int i = 0; i < count; i++, rec += BUZZER_ADV_RECORD_SIZE) {
+        if (rec[0] != target && rec[0] != BUZZER_ADV_TARGET_ALL) {continue;}
+        if (ret.sound >= 0 && rec[2] <= ret.priority) {continue;}
+        ret.sound = rec[1];
+        ret.priority = rec[2];
+        ret.volume = rec[3];
+    }
+    return ret;
+}
+
+
+/** find the AD structure of `type`, return the data after the type
+ *  and its length, {nullptr, 0} if not found or malformed.
+ */
+constexpr std::tuple<const uint8_t*, int> buzzer_adv_field(
+        const uint8_t* src, int len, uint8_t type
+) {
+    for (int i = 0; i < len && src[i] > 0; i += src[i] + 1) {
+        if (i + src[i] >= len) {break;}
+        if (src[i + 1] == type) {return {&src[i + 2], src[i] - 1};}
+    }
+    return {nullptr, 0};
+}
+
+
+/** index of `uuid` in the 16-bit service UUIDs, -1 if not found,
+ *  `BUZZER_ADV_MALFORMED` if the AD structures overrun the data.
+ */
+constexpr int buzzer_adv_uuid16(const uint8_t* src, int len, uint16_t uuid) {
+    int n = 0;
+    for (int i = 0; i < len && src[i] > 0; i += src[i] + 1) {
+        if (i + src[i] >= len) {return BUZZER_ADV_MALFORMED;}
+        if (src[i + 1] != BUZZER_ADV_AD_UUID16_INCOMP &&
+            src[i + 1] != BUZZER_ADV_AD_UUID16_COMP) {continue;}
+        for (int j = i + 2; j + 1 <= i + src[i]; j += 2, n++) {
+            if ((src[j] | (src[j + 1] << 8)) == uuid) {return n;}
+        }
+    }
+    return -1;
+}
+
+
+namespace buzzer_adv_check {
+
+constexpr uint8_t legacy[] = {0xff, 0xff, 2, 0x34, 0x12};
+constexpr uint8_t batch[] = {0xff, 0xff, BUZZER_ADV_BATCH_V1, 0x01, 0x00, 3,
+                             1, 4, 3, 200,
+                             BUZZER_ADV_TARGET_ALL, 5, 1, 100,
+                             2, 6, 9, 255};
+constexpr uint8_t no_records[] = {0xff, 0xff, BUZZER_ADV_BATCH_V1, 1, 0, 0};
+constexpr uint8_t unknown[] = {0xff, 0xff, 0xB3, 1, 0, 1, 1, 4, 0, 200};
+constexpr uint8_t timed[] = {0xff, 0xff, BUZZER_ADV_BATCH_V2, 0x02, 0x00,
+                             0x10, 0x27, 0x2c, 0x28, 1,
+                             BUZZER_ADV_TARGET_ALL, 7, 0, 255};
+
+static_assert(buzzer_adv_decode(legacy, 5, 0).sound == 2);
+static_assert(buzzer_adv_decode(legacy, 5, 0).seq == 0x1234);
+static_assert(buzzer_adv_decode(legacy, 2, 0).sound == -1);
+static_assert(buzzer_adv_decode(batch, sizeof(batch), 0).sound == 5);
+static_assert(buzzer_adv_decode(batch, sizeof(batch), 1).sound == 4);
+static_assert(buzzer_adv_decode(batch, sizeof(batch), 1).volume == 200);
+static_assert(buzzer_adv_decode(batch, sizeof(batch), 2).sound == 6);
+static_assert(buzzer_adv_decode(batch, sizeof(batch) - 1, 2).sound == -1);
+static_assert(buzzer_adv_decode(batch, 5, 0).sound == -1);
+static_assert(buzzer_adv_decode(no_records, 6, 0).sound == -1);
+static_assert(buzzer_adv_decode(unknown, sizeof(unknown), 1).sound == -1);
+static_assert(buzzer_adv_decode(timed, sizeof(timed), 3).sound == 7);
+static_assert(buzzer_adv_decode(timed, sizeof(timed), 3).hub_msec == 10000);
+static_assert(buzzer_adv_decode(timed, sizeof(timed), 3).start_msec == 10284);
+static_assert(!buzzer_adv_decode(batch, sizeof(batch), 1).timed);
+static_assert(buzzer_adv_decode(timed, sizeof(timed) - 1, 3).sound == -1);
+static_assert(!buzzer_adv_decode(timed, 9, 3).timed);
+
+// - flags, 16-bit UUIDs, manufacturer data.
+constexpr uint8_t hub[] = {0x02, 0x01, 0x06,
+                           0x05, 0x03, 0x0f, 0x18, 0x11, 0x18,
+                           0x06, 0xff, 0xff, 0xff, 0x03, 0x01, 0x00};
+constexpr uint8_t beacon[] = {0x02, 0x01, 0x06,
+                              0x05, 0xff, 0x4c, 0x00, 0x02, 0x15};
+constexpr uint8_t overrun[] = {0x02, 0x01, 0x06, 0x05, 0x03, 0x11, 0x18};
+constexpr uint8_t padded[] = {0x03, 0x02, 0x11, 0x18, 0x00, 0x00};
+
+static_assert(buzzer_adv_uuid16(hub, sizeof(hub), 0x1811) == 1);
+static_assert(buzzer_adv_uuid16(hub, sizeof(hub), 0x1812) == -1);
+static_assert(buzzer_adv_uuid16(beacon, sizeof(beacon), 0x1811) == -1);
+static_assert(buzzer_adv_uuid16(overrun, sizeof(overrun), 0x1811) ==
+              BUZZER_ADV_MALFORMED);
+static_assert(buzzer_adv_uuid16(padded, sizeof(padded), 0x1811) == 0);
+static_assert(std::get<1>(buzzer_adv_field(hub, sizeof(hub), 0xff)) == 5);
+static_assert(std::get<0>(buzzer_adv_field(hub, sizeof(hub), 0xff)) ==
+              &hub[11]);
+static_assert(buzzer_adv_decode(hub + 11, 5, 0).sound == 3);
+static_assert(std::get<0>(buzzer_adv_field(overrun, sizeof(overrun),
+                                           0x03)) == nullptr);
+
+}  // namespace buzzer_adv_check
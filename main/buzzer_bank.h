@@ -0,0 +1,233 @@
+/** @file buzzer_bank.h
+ *
+ * Home Buzzer - sound bank upload, the states
+ * ==========================================
+ *
+ * begin/data/end/commit of `buzzer_upload.h` over a storage `Fs`:
+ * the TF card on the device, a fake one in the host tests.
+ *
+ * - a file is written to `TMP` n and verified by its size and CRC32
+ *   at the end, a broken one is removed.
+ * - the commit moves `DST` to `BAK` n and `TMP` n to `DST` for all files,
+ *   then gives the storage with the refresh: the catalog is switched
+ *   before anyone else takes it. a failed rename moves all back.
+ * - abort (the channel closed) removes the temporary files.
+ * - the storage is taken for each access, none without it but closing
+ *   the file of a removed card.
+ *
+ * `Fs` has:
+ *
+ *     bool take();                 /// false without the storage
+ *     void give(bool refresh);     /// refresh the catalog before giving
+ *     bool create(int i);          /// `TMP` i, to write
+ *     bool write(const uint8_t* src, int len);
+ *     void close();
+ *     bool move(buzzer_bank_name from, buzzer_bank_name to, int i,
+ *               const char* name);
+ *     void remove(buzzer_bank_name kind, int i, const char* name);
+ *     uint32_t crc(uint32_t crc, const uint8_t* src, int len);  /// CRC32
+ */
+#pragma once
+#include <stdint.h>
+#include <cstring>
+
+#include "buzzer_upload.h"
+#include "homebuzzer.h"
+
+
+constexpr int BUZZER_BANK_NAME = 13;    /// 8.3 file name and NUL
+
+/// names of a file in the storage, `DST` is the name in the catalog.
+enum class buzzer_bank_name {TMP, BAK, DST};
+
+/// a file uploaded to `TMP`, waiting for the commit.
+struct buzzer_bank_file {
+    char name[BUZZER_BANK_NAME];
+    uint32_t size;
+    uint32_t received;
+    uint32_t crc;
+};
+
+template <class Fs>
+struct buzzer_bank {
+    Fs* fs;
+    buzzer_bank_file files[BUZZER_SOUNDS];
+    int n_files;        /// files in the bank, the last one is open if `open`
+    bool open;
+    uint32_t n_bytes;   /// received for the bank
+};
+
+
+template <class Fs>
+void buzzer_bank_init(buzzer_bank<Fs>& b, Fs* fs) {
+    b = {};
+    b.fs = fs;
+}
+
+
+/// remove the temporary files of the bank, with the storage taken.
+template <class Fs>
+void buzzer_bank_remove(buzzer_bank<Fs>& b) {
+    for (int i = 0; i < b.n_files; i++) {
+        b.fs->remove(buzzer_bank_name::TMP, i, b.files[i].name);
+    }
+}
+
+
+/// discard the files not committed yet, returns the number of them.
+template <class Fs>
+int buzzer_bank_abort(buzzer_bank<Fs>& b) {
+    auto ret = b.n_files;
+    if (ret < 1) {return 0;}
+    if (b.fs->take()) {
+        b.fs->close();
+        buzzer_bank_remove(b);
+        b.fs->give(false);
+    }
+    b.fs->close();  // - the storage was removed.
+    b.open = false;
+    b.n_files = 0;
+    return ret;
+}
+
+
+template <class Fs>
+buzzer_upload_status buzzer_bank_begin(buzzer_bank<Fs>& b,
+                                       const uint8_t* src, int len) {
+    if (len < 7 || src[len - 1] != '\0' || len - 5 > BUZZER_BANK_NAME) {
+        return BUZZER_UPLOAD_E_FORMAT;
+    }
+    auto name = (const char*)&src[5];
+    // - the catalog slot is the first digit of the name.
+    if (name[0] < '0' || name[0] > '9' || strchr(name, '/') != nullptr) {
+        return BUZZER_UPLOAD_E_FORMAT;
+    }
+    if (b.n_files - b.open >= BUZZER_SOUNDS) {
+        return BUZZER_UPLOAD_E_FULL;
+    }
+    if (!b.fs->take()) {return BUZZER_UPLOAD_E_CARD;}
+    b.fs->close();
+    if (b.open) {    // - the last one is not ended, overwrite it.
+        b.n_files--;
+        b.open = false;
+    }
+    auto ok = b.fs->create(b.n_files);
+    b.fs->give(false);
+    if (!ok) {return BUZZER_UPLOAD_E_CARD;}
+
+    auto& file = b.files[b.n_files++];
+    strcpy(file.name, name);
+    memcpy(&file.size, &src[1], sizeof(file.size));
+    file.received = 0;
+    file.crc = 0;
+    b.open = true;
+    if (b.n_files == 1) {
+        b.n_bytes = 0;
+    }
+    return BUZZER_UPLOAD_NO_ACK;
+}
+
+
+template <class Fs>
+buzzer_upload_status buzzer_bank_data(buzzer_bank<Fs>& b,
+                                      const uint8_t* src, int len) {
+    if (!b.open) {return BUZZER_UPLOAD_E_FORMAT;}
+    auto& file = b.files[b.n_files - 1];
+    if (file.received + len > file.size) {return BUZZER_UPLOAD_E_VERIFY;}
+
+    if (!b.fs->take()) {return BUZZER_UPLOAD_E_CARD;}
+    auto ok = b.fs->write(src, len);
+    b.fs->give(false);
+    if (!ok) {return BUZZER_UPLOAD_E_CARD;}
+
+    file.crc = b.fs->crc(file.crc, src, len);
+    file.received += len;
+    b.n_bytes += len;
+    return BUZZER_UPLOAD_NO_ACK;
+}
+
+
+/// close the last file, a broken one is removed from the bank.
+template <class Fs>
+buzzer_upload_status buzzer_bank_end(buzzer_bank<Fs>& b,
+                                     const uint8_t* src, int len) {
+    if (!b.open || len != 5) {return BUZZER_UPLOAD_E_FORMAT;}
+    auto& file = b.files[b.n_files - 1];
+    uint32_t crc = 0;
+    memcpy(&crc, &src[1], sizeof(crc));
+
+    if (!b.fs->take()) {return BUZZER_UPLOAD_E_CARD;}
+    b.fs->close();
+    b.open = false;
+    const bool broken = file.received != file.size || file.crc != crc;
+    if (broken) {
+        b.fs->remove(buzzer_bank_name::TMP, b.n_files - 1, file.name);
+        b.n_files--;
+    }
+    b.fs->give(false);
+    return broken ? BUZZER_UPLOAD_E_VERIFY : BUZZER_UPLOAD_OK;
+}
+
+
+/** move the uploaded files over the old ones, the old ones are kept as
+ *  `BAK` until all files are moved, and moved back on a failure.
+ */
+template <class Fs>
+buzzer_upload_status buzzer_bank_commit(buzzer_bank<Fs>& b) {
+    constexpr auto TMP = buzzer_bank_name::TMP;
+    constexpr auto BAK = buzzer_bank_name::BAK;
+    constexpr auto DST = buzzer_bank_name::DST;
+    if (b.open || b.n_files < 1) {return BUZZER_UPLOAD_E_FORMAT;}
+    if (!b.fs->take()) {return BUZZER_UPLOAD_E_CARD;}
+    auto fs = b.fs;
+    bool olds[BUZZER_SOUNDS] = {};
+    int i = 0;
+    for (; i < b.n_files; i++) {
+        auto name = b.files[i].name;
+        fs->remove(BAK, i, name);    // - left by a power loss.
+        olds[i] = fs->move(DST, BAK, i, name);
+        if (!fs->move(TMP, DST, i, name)) {
+            if (olds[i]) {fs->move(BAK, DST, i, name);}
+            break;
+        }
+    }
+    const bool ok = i == b.n_files;
+    // - in the reverse order, a name uploaded twice is restored correctly.
+    while (i-- > 0) {
+        auto name = b.files[i].name;
+        if (ok) {
+            if (olds[i]) {fs->remove(BAK, i, name);}
+            continue;
+        }
+        fs->move(DST, TMP, i, name);
+        if (olds[i]) {fs->move(BAK, DST, i, name);}
+    }
+    if (!ok) {
+        buzzer_bank_remove(b);
+    }
+    // - the catalog is switched once for the whole bank, before the give.
+    fs->give(ok);
+    b.n_files = 0;
+    return ok ? BUZZER_UPLOAD_OK : BUZZER_UPLOAD_E_CARD;
+}
+
+
+/** process an SDU of the bank (not the stream),
+ *  return the status to answer, or `BUZZER_UPLOAD_NO_ACK`.
+ */
+template <class Fs>
+buzzer_upload_status buzzer_bank_feed(buzzer_bank<Fs>& b,
+                                      const uint8_t* src, int len) {
+    if (len < 1) {return BUZZER_UPLOAD_E_FORMAT;}
+    switch (src[0]) {
+    case BUZZER_UPLOAD_BEGIN:
+        return buzzer_bank_begin(b, src, len);
+    case BUZZER_UPLOAD_DATA:
+        return buzzer_bank_data(b, src + 1, len - 1);
+    case BUZZER_UPLOAD_END:
+        return buzzer_bank_end(b, src, len);
+    case BUZZER_UPLOAD_COMMIT:
+        return buzzer_bank_commit(b);
+    }
+    return BUZZER_UPLOAD_E_FORMAT;
+}
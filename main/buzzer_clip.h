@@ -0,0 +1,87 @@
+/** @file buzzer_clip.h
+ *
+ * Home Buzzer - raw sectors of the sound files
+ * ==========================================
+ *
+ * a sound file stored in one fragment is read by the card sectors,
+ * without FATFS while playing. the others are read by the file.
+ *
+ * - the cluster map is the link map of FATFS (`CREATE_LINKMAP`):
+ *   {n_items, (n_clusters, cluster)..., 0}. a map larger than the table
+ *   leaves only `n_items` (`FR_NOT_ENOUGH_CORE`).
+ * - FATFS sectors are converted to the card sectors, a clip not aligned
+ *   to them is read by the file too.
+ */
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <tuple>
+
+
+/// layout of the FAT volume and the card, from `FATFS` and `sdmmc_card_t`.
+struct buzzer_clip_fs {
+    uint64_t database;      /// first FATFS sector of the data area
+    uint32_t csize;         /// FATFS sectors per cluster
+    uint32_t fs_ssize;      /// bytes per FATFS sector
+    uint32_t card_ssize;    /// bytes per card sector
+};
+
+
+/** the first cluster of the map if the file is in one fragment,
+ *  or 0 if fragmented (or the map did not fit `n_clmt`).
+ */
+constexpr uint32_t buzzer_clip_cluster(const uint32_t* clmt, int n_clmt) {
+    if (n_clmt < 4 || clmt[0] != 4 || clmt[1] < 1 || clmt[3] != 0) {
+        return 0;
+    }
+    return clmt[2];
+}
+
+
+/** the first card sector of the clip at `cluster` (0 for fragmented),
+ *  or 0 if it is not aligned to the card sectors or a frame of
+ *  `n_frame` bytes is not the whole card sectors.
+ */
+constexpr uint32_t buzzer_clip_sector(const buzzer_clip_fs& fs,
+                                      uint32_t cluster, int n_frame) {
+    if (cluster < 2 || fs.card_ssize < 1 || n_frame % fs.card_ssize != 0) {
+        return 0;
+    }
+    uint64_t ofs = (fs.database + fs.csize * (uint64_t)(cluster - 2)) *
+                   fs.fs_ssize;
+    if (ofs % fs.card_ssize != 0) {return 0;}
+    return ofs / fs.card_ssize;
+}
+
+
+/** the next read of the clip with `remain` bytes, by frames of
+ *  `n_frame` bytes: returns {bytes of the clip, card sectors to read}.
+ */
+constexpr std::tuple<uint32_t, uint32_t> buzzer_clip_next(
+        uint32_t remain, int n_frame, uint32_t card_ssize
+) {
+    auto n = std::min(remain, (uint32_t)n_frame);
+    return {n, (n + card_ssize - 1) / card_ssize};
+}
+
+
+namespace buzzer_clip_check {
+
+constexpr buzzer_clip_fs fat32 = {8192, 64, 512, 512};
+constexpr uint32_t one[] = {4, 10, 7, 0};
+constexpr uint32_t two[] = {6, 10, 7, 3, 20, 0};
+constexpr uint32_t overflow[] = {6, 10, 7, 0};  // - `FR_NOT_ENOUGH_CORE`
+static_assert(buzzer_clip_cluster(one, 4) == 7);
+static_assert(buzzer_clip_cluster(two, 6) == 0);
+static_assert(buzzer_clip_cluster(overflow, 4) == 0);
+static_assert(buzzer_clip_sector(fat32, 7, 2048) == 8192 + 64 * 5);
+static_assert(buzzer_clip_sector(fat32, 0, 2048) == 0);
+// - 4 kB card sectors: the data area is not aligned.
+constexpr buzzer_clip_fs unaligned = {8193, 8, 512, 4096};
+static_assert(buzzer_clip_sector(unaligned, 3, 4096) == 0);
+static_assert(buzzer_clip_sector(unaligned, 2, 2048) == 0);
+static_assert(std::get<1>(buzzer_clip_next(2048, 2048, 512)) == 4);
+static_assert(std::get<0>(buzzer_clip_next(100, 2048, 512)) == 100);
+static_assert(std::get<1>(buzzer_clip_next(100, 2048, 512)) == 1);
+
+}  // namespace buzzer_clip_check
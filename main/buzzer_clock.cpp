@@ -0,0 +1,38 @@
+/** @file buzzer_clock.cpp
+ *
+ * Home Buzzer - hub clock estimation
+ * ==================================
+ *
+ */
+#include <stdint.h>
+
+#include "buzzer_clock.h"
+
+
+static buzzer_clock clock_hub = {-1, 0, {}, 0, 0, 0};
+
+
+void buzzer_clock_update(uint16_t hub_msec, int64_t usec) {
+    buzzer_clock_update(clock_hub, hub_msec, usec);
+}
+
+
+void buzzer_clock_reset(void) {
+    clock_hub.n_resets = 0;
+    buzzer_clock_init(clock_hub);
+}
+
+
+int64_t buzzer_clock_to_local(uint16_t msec) {
+    return buzzer_clock_to_local(clock_hub, msec);
+}
+
+
+bool buzzer_clock_synced(int64_t usec) {
+    return buzzer_clock_synced(clock_hub, usec);
+}
+
+
+int64_t buzzer_clock_spread(void) {
+    return buzzer_clock_spread(clock_hub);
+}
@@ -0,0 +1,203 @@
+/** @file buzzer_clock.h
+ *
+ * Home Buzzer - hub clock estimation
+ * ==========================================
+ *
+ * estimates the hub clock from the timed advertisements, to start the
+ * sound at the same time in all rooms.
+ *
+ * - offset = local time - hub time, the minimum in the recent
+ *   advertisements is used (the least delayed one by the scan).
+ * - the hub clock is msec and wraps at 65536, unwrapped by the local time.
+ * - a hub time far from the expected one (the hub was restarted), or
+ *   an update after a long gap, starts the estimation again.
+ */
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+
+
+#define BUZZER_CLOCK_SAMPLES 16
+#define BUZZER_CLOCK_RESET_MSEC 500         /// jump of the hub clock, above the scan delays
+#define BUZZER_CLOCK_GAP_USEC 30000000      /// less than the half wrap
+
+
+/// state of the estimation.
+struct buzzer_clock {
+    int64_t hub_last;       /// unwrapped hub time (msec), -1 if none
+    int64_t local_last;     /// local time (usec) of `hub_last`
+    int64_t offsets[BUZZER_CLOCK_SAMPLES];
+    int n_offsets;
+    int i_offset;
+    uint32_t n_resets;      /// restarts by the hub clock jumps
+};
+
+
+constexpr void buzzer_clock_init(buzzer_clock& c) {
+    auto n_resets = c.n_resets;
+    c = {};
+    c.hub_last = -1;
+    c.n_resets = n_resets;
+}
+
+
+/// update the estimation by an advertisement received at `usec`.
+constexpr void buzzer_clock_update(buzzer_clock& c, uint16_t hub_msec,
+                                   int64_t usec) {
+    if (c.hub_last >= 0) {
+        // - unwrap around the expected hub time.
+        int64_t expect = c.hub_last + (usec - c.local_last) / 1000;
+        int diff = (int16_t)(hub_msec - (uint16_t)expect);
+        if (usec - c.local_last > BUZZER_CLOCK_GAP_USEC ||
+                diff > BUZZER_CLOCK_RESET_MSEC ||
+                diff < -BUZZER_CLOCK_RESET_MSEC) {
+            c.n_resets++;
+            buzzer_clock_init(c);
+        } else {
+            c.hub_last = expect + diff;
+        }
+    }
+    if (c.hub_last < 0) {
+        c.hub_last = hub_msec;
+    }
+    c.local_last = usec;
+    c.offsets[c.i_offset] = usec - c.hub_last * 1000;
+    c.i_offset = (c.i_offset + 1) % BUZZER_CLOCK_SAMPLES;
+    c.n_offsets = std::min(c.n_offsets + 1, BUZZER_CLOCK_SAMPLES);
+}
+
+
+/// local time (usec) of the hub time `msec`, 0 without the estimation.
+constexpr int64_t buzzer_clock_to_local(const buzzer_clock& c,
+                                        uint16_t msec) {
+    if (c.hub_last < 0) {return 0;}
+    auto hub = c.hub_last + (int16_t)(msec - (uint16_t)c.hub_last);
+    return hub * 1000 + *std::min_element(c.offsets,
+                                          c.offsets + c.n_offsets);
+}
+
+
+/** true if the estimation is valid at `usec`: an advertisement within
+ *  `BUZZER_CLOCK_GAP_USEC`, to unwrap the hub time without ambiguity.
+ */
+constexpr bool buzzer_clock_synced(const buzzer_clock& c, int64_t usec) {
+    return c.hub_last >= 0 && usec - c.local_last <= BUZZER_CLOCK_GAP_USEC;
+}
+
+
+/// spread of the offsets in the window, the uncertainty of the estimation.
+constexpr int64_t buzzer_clock_spread(const buzzer_clock& c) {
+    if (c.n_offsets < 1) {return 0;}
+    auto [lo, hi] = std::minmax_element(c.offsets, c.offsets + c.n_offsets);
+    return *hi - *lo;
+}
+
+
+// - the estimation of this buzzer, from the advertisements.
+extern void buzzer_clock_update(uint16_t hub_msec, int64_t usec);
+extern int64_t buzzer_clock_to_local(uint16_t msec);
+extern bool buzzer_clock_synced(int64_t usec);
+extern int64_t buzzer_clock_spread(void);
+extern void buzzer_clock_reset(void);
+
+
+namespace buzzer_clock_check {
+
+constexpr bool synced() {
+    buzzer_clock c = {};
+    buzzer_clock_init(c);
+    if (buzzer_clock_synced(c, 0)) {return false;}
+    buzzer_clock_update(c, 100, 1000000);
+    return buzzer_clock_synced(c, 1000000 + BUZZER_CLOCK_GAP_USEC) &&
+           !buzzer_clock_synced(c, 1000001 + BUZZER_CLOCK_GAP_USEC);
+}
+static_assert(synced());
+
+struct result {
+    int64_t skew;       /// max - min of the true start times (usec)
+    int64_t spread;     /// max of `buzzer_clock_spread()` of the receivers
+    uint32_t resets;
+};
+
+/** `N` receivers with random local clocks (+-20 ppm) scan the hub
+ *  advertisements (every 100 msec) with random delays up to `delay_ms`,
+ *  and schedule a start 300 msec ahead of the last advertisement.
+ *  the hub clock starts at `hub0`, and jumps to 100 msec at `reset_at`.
+ */
+constexpr result simulate(int n_advs, int delay_ms, uint16_t hub0,
+                          int reset_at, uint32_t seed) {
+    constexpr int N = 8;
+    auto rand = [&seed] () {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+    buzzer_clock clocks[N] = {};
+    int64_t local0[N] = {};
+    int ppm[N] = {};
+    for (int i = 0; i < N; i++) {
+        buzzer_clock_init(clocks[i]);
+        local0[i] = rand() % 100000000;
+        ppm[i] = (int)(rand() % 41) - 20;
+    }
+    // - true time (usec) to the local time of the receiver.
+    auto local = [&] (int i, int64_t t) {
+        return local0[i] + t + t * ppm[i] / 1000000;
+    };
+
+    int64_t t = 0;
+    uint16_t hub = hub0;
+    int64_t t_hub = 0;   /// true time of `hub` (msec exact)
+    for (int k = 0; k < n_advs; k++) {
+        t = k * 100000LL;
+        hub = k < reset_at ? (uint16_t)(hub0 + k * 100)
+                           : (uint16_t)(100 + (k - reset_at) * 100);
+        t_hub = t;
+        for (int i = 0; i < N; i++) {
+            auto delay = rand() % (delay_ms * 1000 + 1);
+            buzzer_clock_update(clocks[i], hub, local(i, t + delay));
+        }
+    }
+
+    result ret = {0, 0, 0};
+    int64_t lo = INT64_MAX, hi = INT64_MIN;
+    for (int i = 0; i < N; i++) {
+        auto start = buzzer_clock_to_local(clocks[i], (uint16_t)(hub + 300));
+        // - back to the true time.
+        auto t_start = start - local0[i];
+        t_start -= t_start * ppm[i] / 1000000;
+        lo = std::min(lo, t_start);
+        hi = std::max(hi, t_start);
+        ret.spread = std::max(ret.spread, buzzer_clock_spread(clocks[i]));
+        ret.resets += clocks[i].n_resets;
+        // - far from the true start: a wrong unwrap.
+        if (t_start < t_hub + 300000 - 1000 ||
+                t_start > t_hub + 300000 + delay_ms * 1000 + 1000) {
+            ret.skew = INT64_MAX;
+            return ret;
+        }
+    }
+    ret.skew = hi - lo;
+    return ret;
+}
+
+// - the skew is bounded by the spread of the receivers (and 1 msec of
+//   the hub clock resolution).
+constexpr auto steady = simulate(40, 50, 1000, 1000, 1);
+static_assert(steady.skew <= steady.spread + 1000);
+static_assert(steady.skew < 20000);
+static_assert(steady.resets == 0);
+// - the hub clock wraps while scanning.
+constexpr auto wrap = simulate(40, 50, 64000, 1000, 7);
+static_assert(wrap.skew <= wrap.spread + 1000);
+static_assert(wrap.resets == 0);
+// - the hub restarts: all receivers start again, and agree after it.
+constexpr auto reset = simulate(60, 50, 30000, 20, 3);
+static_assert(reset.resets == 8);
+static_assert(reset.skew <= reset.spread + 1000);
+// - just after the restart: no wrong unwrap, within the scan delay.
+constexpr auto just = simulate(21, 50, 30000, 20, 5);
+static_assert(just.skew <= 50000 + 1000);
+
+}  // namespace buzzer_clock_check
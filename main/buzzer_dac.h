@@ -0,0 +1,178 @@
+/** @file buzzer_dac.h
+ *
+ * Home Buzzer - DAC channel routing
+ * ==========================================
+ *
+ * `BUZZER_DAC_OUTPUT` selects the channels of the internal DAC,
+ * the samples are packed to the bytes of the DAC continuous (DMA) driver:
+ *
+ * - channel 1 (GPIO25, M5 Stack) or channel 2 (GPIO26):
+ *   stereo sounds are mixed down to mono.
+ * - stereo: left to channel 1, right to channel 2 alternately,
+ *   mono sounds are output to both.
+ */
+#pragma once
+#include <stdint.h>
+#include <tuple>
+
+#include "sdkconfig.h"
+
+
+#if CONFIG_BUZZER_DAC_STEREO
+constexpr bool buzzer_dac_stereo = true;
+#else
+constexpr bool buzzer_dac_stereo = false;
+#endif
+constexpr int buzzer_dac_n_chs = buzzer_dac_stereo ? 2 : 1;
+constexpr int BUZZER_DAC_BLOCK = 512;   /// bytes per DMA write
+constexpr int BUZZER_DAC_DESCS = 4;     /// DMA descriptors
+constexpr int BUZZER_DAC_BUF = 256;     /// bytes per DMA descriptor
+constexpr int BUZZER_DAC_RATE = 16000;  /// Hz of the synthesized sounds (APLL)
+
+
+/** usec of the DMA queue at `rate`, between a write and the speaker:
+ *  the writes block while it is full, so a playing sound keeps it full.
+ */
+constexpr int64_t buzzer_dac_queue_usec(int rate) {
+    return BUZZER_DAC_DESCS * BUZZER_DAC_BUF * 1000000LL /
+           (rate * buzzer_dac_n_chs);
+}
+
+
+/// DAC level of a 8-bit sample.
+constexpr int buzzer_dac_level(int val, int volume) {
+    return (((val * volume) / 256 % 128) / 3) + 64;
+}
+
+
+/** read a frame of the interleaved samples, as 8-bit left and right.
+ *  mono sounds return the same sample for both.
+ */
+constexpr std::tuple<int, int, int> buzzer_dac_read2(
+        const int8_t* src, int m, int n_bits, bool streao
+) {
+    auto s16 = [src] (int ofs) {
+        return (int)(int16_t)((uint8_t)src[ofs] | (src[ofs + 1] << 8));
+    };
+    if (streao) {
+        if (n_bits == 16) {
+            return {4, s16(m) / 256, s16(m + 2) / 256};
+        }
+        return {2, src[m], src[m + 1]};
+    }
+    if (n_bits == 16) {
+        auto v = s16(m) / 256;
+        return {2, v, v};
+    }
+    return {1, src[m], src[m]};
+}
+
+
+/** pack the interleaved samples to the DAC bytes, up to `n_dst` bytes.
+ *  returns the bytes read from `src` and written to `dst`.
+ */
+constexpr std::tuple<int, int> buzzer_dac_pack(
+        const int8_t* src, int len, int n_bits, bool streao, int volume,
+        bool stereo_out, uint8_t* dst, int n_dst
+) {
+    int n = 0, m = 0;
+    const int n_chs = stereo_out ? 2 : 1;
+    while (n < len && m + n_chs <= n_dst) {
+        auto [idx, l, r] = buzzer_dac_read2(src, n, n_bits, streao);
+        n += idx;
+        if (stereo_out) {
+            dst[m++] = buzzer_dac_level(l, volume);
+            dst[m++] = buzzer_dac_level(r, volume);
+        } else {
+            dst[m++] = buzzer_dac_level((l + r) / 2, volume);
+        }
+    }
+    return {n, m};
+}
+
+
+/** pack the 16-bit planar channels (`r` may be `l`) to the DAC bytes,
+ *  `dst` has `n` or `2 * n` bytes, returns the written bytes.
+ */
+constexpr int buzzer_dac_pack16(const int16_t* l, const int16_t* r, int n,
+                                int volume, bool stereo_out, uint8_t* dst) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (stereo_out) {
+            dst[m++] = buzzer_dac_level(l[i] / 256, volume);
+            dst[m++] = buzzer_dac_level(r[i] / 256, volume);
+        } else {
+            dst[m++] = buzzer_dac_level(((int)l[i] + r[i]) / 512, volume);
+        }
+    }
+    return m;
+}
+
+
+namespace buzzer_dac_check {
+
+constexpr int8_t stereo16[] = {0x00, 0x10, 0x00, (int8_t)0xF0,   // - L, R
+                               0x00, 0x20, 0x00, (int8_t)0xE0};
+constexpr int8_t stereo8[] = {0x10, -0x10, 0x20, -0x20};
+constexpr int8_t mono16[] = {0x00, 0x30, 0x00, (int8_t)0xD0};
+
+constexpr bool routed(const int8_t* src, int len, int n_bits, bool streao,
+                      const int* l, const int* r, int n) {
+    int i = 0, m = 0;
+    for (; m < len; i++) {
+        auto [idx, vl, vr] = buzzer_dac_read2(src, m, n_bits, streao);
+        if (i >= n || vl != l[i] || vr != r[i]) {return false;}
+        m += idx;
+    }
+    return i == n && m == len;
+}
+
+constexpr int l_stereo[] = {0x10, 0x20}, r_stereo[] = {-0x10, -0x20};
+constexpr int l_mono[] = {0x30, -0x30};
+constexpr int l_mono8[] = {0x10, -0x10, 0x20, -0x20};
+static_assert(routed(stereo16, 8, 16, true, l_stereo, r_stereo, 2));
+static_assert(routed(stereo8, 4, 8, true, l_stereo, r_stereo, 2));
+static_assert(routed(mono16, 4, 16, false, l_mono, l_mono, 2));
+static_assert(routed(stereo8, 4, 8, false, l_mono8, l_mono8, 4));
+
+// - the stream of 8 kHz waits 128 msec in the queue of a channel.
+static_assert(buzzer_dac_queue_usec(8000) * buzzer_dac_n_chs == 128000);
+
+static_assert(buzzer_dac_level(0, 256) == 64);
+static_assert(buzzer_dac_level(127, 256) == 106);
+static_assert(buzzer_dac_level(-127, 256) == 22);
+
+/// the DAC bytes of `src`, packed by `n_dst` bytes.
+template <int N>
+struct packed {
+    uint8_t bytes[N];
+    int n;
+};
+
+template <int N>
+constexpr packed<N> pack(const int8_t* src, int len, int n_bits, bool streao,
+                         bool stereo_out, int n_dst) {
+    packed<N> ret = {{}, 0};
+    for (int n = 0; n < len;) {
+        auto [n_src, m] = buzzer_dac_pack(src + n, len - n, n_bits, streao,
+                                          256, stereo_out, ret.bytes + ret.n,
+                                          n_dst);
+        n += n_src;
+        ret.n += m;
+    }
+    return ret;
+}
+
+// - stereo out: alternate L, R; a mono sound to both.
+constexpr auto alter = pack<4>(stereo16, 8, 16, true, true, 2);
+static_assert(alter.n == 4);
+static_assert(alter.bytes[0] == buzzer_dac_level(0x10, 256));
+static_assert(alter.bytes[1] == buzzer_dac_level(-0x10, 256));
+static_assert(alter.bytes[3] == buzzer_dac_level(-0x20, 256));
+constexpr auto both = pack<4>(mono16, 4, 16, false, true, 3);
+static_assert(both.n == 4 && both.bytes[0] == both.bytes[1]);
+// - mono out: the stereo sound is mixed down.
+constexpr auto mixed = pack<2>(stereo8, 4, 8, true, false, 1);
+static_assert(mixed.n == 2 && mixed.bytes[0] == 64 && mixed.bytes[1] == 64);
+
+}  // namespace buzzer_dac_check
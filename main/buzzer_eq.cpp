@@ -0,0 +1,50 @@
+/** @file buzzer_eq.cpp
+ *
+ * Home Buzzer - speaker compensation filter
+ * ==================================
+ *
+ */
+#include <stdint.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "rom/ets_sys.h"
+
+#include "buzzer_eq.h"
+#include "homebuzzer.h"
+
+
+#if CONFIG_BUZZER_EQ_BENCH
+static const char tag[] = TAG_BUZZER;
+
+/** filter a noise block with the 44.1 kHz coefficients at boot,
+ *  and report the cycles per sample against the budget of 44.1 kHz.
+ */
+extern "C" void buzzer_eq_bench(void) {
+    static int16_t buf[BUZZER_EQ_BLOCK];
+    const int rate = 44100;
+    const int n_blocks = 64;
+    const auto coefs = buzzer_eq_find(rate);
+    buzzer_biquad_state states[BUZZER_EQ_BANDS] = {};
+
+    uint32_t seed = 0x1234567;
+    uint32_t cycles = 0;
+    for (int i = 0; i < n_blocks; i++) {
+        for (auto& v : buf) {
+            seed = seed * 1103515245 + 12345;
+            v = (int16_t)(seed >> 16) / 2;
+        }
+        auto t = esp_cpu_get_cycle_count();
+        buzzer_eq_process(*coefs, states, buf, BUZZER_EQ_BLOCK);
+        cycles += esp_cpu_get_cycle_count() - t;
+    }
+    const int n_samples = n_blocks * BUZZER_EQ_BLOCK;
+    const uint32_t budget = ets_get_cpu_frequency() * 1000000 / rate;
+    ESP_LOGI(tag, "eq-bench: %d bands, %d.%02d cycles/sample "
+             "(budget %d at %d Hz, %d%%)", BUZZER_EQ_BANDS,
+             (int)(cycles / n_samples),
+             (int)(cycles * 100ULL / n_samples % 100),
+             (int)budget, rate,
+             (int)(cycles * 100ULL / n_samples / budget));
+}
+#endif
@@ -0,0 +1,218 @@
+/** @file buzzer_eq.h
+ *
+ * Home Buzzer - speaker compensation filter
+ * ==========================================
+ *
+ * cascaded biquads between the decode and the DAC,
+ * the profile is selected by `BUZZER_EQ_PROFILE` in menuconfig.
+ *
+ * - coefficients are designed at compile time (RBJ cookbook) for the
+ *   common sample rates, other rates are played without the filter.
+ * - samples are Q15, coefficients Q30 (2 integer bits for `a1`),
+ *   Direct Form I with a 64-bit accumulator.
+ * - the M5 Stack speaker reproduces almost nothing below 300-400 Hz,
+ *   the high-pass removes this energy (only distorting the speaker)
+ *   and a presence peak adds the loudness back.
+ */
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+
+#include "sdkconfig.h"
+
+#include "buzzer_synth.h"
+
+
+constexpr int BUZZER_EQ_BLOCK = 256;    /// samples per filter block
+constexpr int BUZZER_EQ_Q = 30;
+
+/// coefficients of a biquad, normalized by a0.
+struct buzzer_biquad {
+    int32_t b0, b1, b2;
+    int32_t a1, a2;
+};
+
+/// state of a biquad, the previous inputs and outputs.
+struct buzzer_biquad_state {
+    int32_t x1, x2;
+    int32_t y1, y2;
+};
+
+enum class buzzer_eq_type {HPF, PEAK};
+
+struct buzzer_eq_band {
+    buzzer_eq_type type;
+    double hz;
+    double q;
+    double db;      /// gain of the peak
+};
+
+#if CONFIG_BUZZER_EQ_M5STACK
+constexpr buzzer_eq_band buzzer_eq_bands[] = {
+    {buzzer_eq_type::HPF, 350, 0.54, 0},    // - 4th order Butterworth
+    {buzzer_eq_type::HPF, 350, 1.31, 0},
+    {buzzer_eq_type::PEAK, 2500, 1.0, 4},
+};
+#elif CONFIG_BUZZER_EQ_VOICE
+constexpr buzzer_eq_band buzzer_eq_bands[] = {
+    {buzzer_eq_type::HPF, 500, 0.71, 0},
+    {buzzer_eq_type::PEAK, 3000, 1.4, 6},
+};
+#else
+constexpr buzzer_eq_band buzzer_eq_bands[] = {
+    {buzzer_eq_type::PEAK, 1000, 1.0, 0},   // - flat, not used
+};
+#endif
+constexpr int BUZZER_EQ_BANDS = sizeof(buzzer_eq_bands) /
+                                sizeof(buzzer_eq_bands[0]);
+constexpr int buzzer_eq_rates[] = {8000, 11025, 16000, 22050,
+                                   32000, 44100, 48000};
+constexpr int BUZZER_EQ_RATES = sizeof(buzzer_eq_rates) /
+                                sizeof(buzzer_eq_rates[0]);
+
+using buzzer_eq_coefs = std::array<buzzer_biquad, BUZZER_EQ_BANDS>;
+
+
+constexpr double buzzer_eq_exp(double x) {
+    double term = 1, sum = 1;
+    for (int k = 1; k < 30; k++) {
+        term *= x / k;
+        sum += term;
+    }
+    return sum;
+}
+
+
+constexpr buzzer_biquad buzzer_eq_design(const buzzer_eq_band& band,
+                                         int rate) {
+    constexpr double pi = 3.14159265358979323846;
+    auto w0 = 2 * pi * band.hz / rate;
+    auto sinw = buzzer_synth_sin(w0);
+    auto cosw = buzzer_synth_sin(w0 + pi / 2);
+    auto alpha = sinw / (2 * band.q);
+    auto a = buzzer_eq_exp(band.db / 40 * 2.302585092994046);   // - 10^(dB/40)
+
+    double b0 = 0, b1 = 0, b2 = 0, a0 = 0, a1 = 0, a2 = 0;
+    switch (band.type) {
+    case buzzer_eq_type::HPF:
+        b0 = (1 + cosw) / 2; b1 = -(1 + cosw); b2 = b0;
+        a0 = 1 + alpha; a1 = -2 * cosw; a2 = 1 - alpha;
+        break;
+    case buzzer_eq_type::PEAK:
+        b0 = 1 + alpha * a; b1 = -2 * cosw; b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a; a1 = -2 * cosw; a2 = 1 - alpha / a;
+        break;
+    }
+    auto q = [a0] (double v) {
+        v = v / a0 * (1 << BUZZER_EQ_Q);
+        return (int32_t)(v < 0 ? v - 0.5 : v + 0.5);
+    };
+    return {q(b0), q(b1), q(b2), q(a1), q(a2)};
+}
+
+
+/// coefficients for all rates of `buzzer_eq_rates`.
+constexpr auto buzzer_eq_table = [] () {
+    std::array<buzzer_eq_coefs, BUZZER_EQ_RATES> ret{};
+    for (int i = 0; i < BUZZER_EQ_RATES; i++) {
+        for (int j = 0; j < BUZZER_EQ_BANDS; j++) {
+            ret[i][j] = buzzer_eq_design(buzzer_eq_bands[j],
+                                         buzzer_eq_rates[i]);
+        }
+    }
+    return ret;
+}();
+
+
+/// coefficients for the sample rate, nullptr if the rate is not supported.
+constexpr const buzzer_eq_coefs* buzzer_eq_find(int rate) {
+    for (int i = 0; i < BUZZER_EQ_RATES; i++) {
+        if (buzzer_eq_rates[i] == rate) {return &buzzer_eq_table[i];}
+    }
+    return nullptr;
+}
+
+
+/// filter `n` samples in place.
+constexpr void buzzer_eq_process(const buzzer_eq_coefs& coefs,
+                                 buzzer_biquad_state* states,
+                                 int16_t* buf, int n) {
+    for (int i = 0; i < n; i++) {
+        int32_t x = buf[i];
+        for (int j = 0; j < BUZZER_EQ_BANDS; j++) {
+            const auto& c = coefs[j];
+            auto& s = states[j];
+            int64_t acc = (int64_t)c.b0 * x + (int64_t)c.b1 * s.x1 +
+                          (int64_t)c.b2 * s.x2 - (int64_t)c.a1 * s.y1 -
+                          (int64_t)c.a2 * s.y2;
+            int32_t y = (int32_t)(acc >> BUZZER_EQ_Q);
+            s.x2 = s.x1;
+            s.x1 = x;
+            s.y2 = s.y1;
+            s.y1 = y;
+            x = y;
+        }
+        buf[i] = (int16_t)std::clamp(x, (int32_t)INT16_MIN,
+                                     (int32_t)INT16_MAX);
+    }
+}
+
+
+namespace buzzer_eq_check {
+
+/// gain of the cascade in dB at `hz`, from the quantized coefficients.
+constexpr double gain_db(const buzzer_eq_coefs& coefs, int rate, double hz) {
+    constexpr double pi = 3.14159265358979323846;
+    auto w = 2 * pi * hz / rate;
+    double c1 = buzzer_synth_sin(w + pi / 2), s1 = buzzer_synth_sin(w);
+    double c2 = buzzer_synth_sin(2 * w + pi / 2), s2 = buzzer_synth_sin(2 * w);
+    double power = 1;
+    for (const auto& i : coefs) {
+        constexpr double one = 1 << BUZZER_EQ_Q;
+        double b0 = i.b0 / one, b1 = i.b1 / one, b2 = i.b2 / one;
+        double a1 = i.a1 / one, a2 = i.a2 / one;
+        // - H(z) at z = e^jw, z^-1 = c1 - j s1, z^-2 = c2 - j s2.
+        double nr = b0 + b1 * c1 + b2 * c2, ni = -b1 * s1 - b2 * s2;
+        double dr = 1 + a1 * c1 + a2 * c2, di = -a1 * s1 - a2 * s2;
+        power *= (nr * nr + ni * ni) / (dr * dr + di * di);
+    }
+    // - 10 log10(power) by the binary exponent, enough for the checks.
+    double db = 0;
+    while (power > 2) {power /= 2; db += 3.0103;}
+    while (power < 1) {power *= 2; db -= 3.0103;}
+    return db + (power - 1) * 3.0103;
+}
+
+constexpr bool stable(const buzzer_eq_coefs& coefs) {
+    constexpr int32_t one = 1 << BUZZER_EQ_Q;
+    for (const auto& i : coefs) {
+        if (i.a2 >= one || i.a2 <= -one) {return false;}
+        if (i.a1 >= one + i.a2 || -i.a1 >= one + i.a2) {return false;}
+    }
+    return true;
+}
+
+constexpr bool all_stable() {
+    for (const auto& i : buzzer_eq_table) {
+        if (!stable(i)) {return false;}
+    }
+    return true;
+}
+static_assert(all_stable());
+static_assert(buzzer_eq_find(44100) != nullptr);
+static_assert(buzzer_eq_find(12345) == nullptr);
+
+#if CONFIG_BUZZER_EQ_M5STACK || CONFIG_BUZZER_EQ_VOICE
+constexpr auto& coefs_44k = *buzzer_eq_find(44100);
+constexpr auto& coefs_8k = *buzzer_eq_find(8000);
+// - the lows are cut, and the presence band is boosted.
+static_assert(gain_db(coefs_44k, 44100, 100) < -12);
+static_assert(gain_db(coefs_44k, 44100, 2700) > 2);
+static_assert(gain_db(coefs_44k, 44100, 2700) < 8);
+static_assert(gain_db(coefs_44k, 44100, 12000) > -1.5);
+static_assert(gain_db(coefs_8k, 8000, 100) < -12);
+static_assert(gain_db(coefs_8k, 8000, 2700) > 2);
+#endif
+
+}  // namespace buzzer_eq_check
@@ -0,0 +1,379 @@
+/** @file buzzer_filter.h
+ *
+ * Home Buzzer - advertisement filter stages
+ * ==========================================
+ *
+ * `buzzer_filter_pass()` runs the stages in the order until one of
+ * them rejects the advertisement.
+ *
+ * - each stage counts its runs, rejects and CPU cycles.
+ * - every `BUZZER_FILTER_PERIOD` advertisements the stages are sorted
+ *   by rejects per cycle (the cheap and selective ones first),
+ *   within the dependencies of `buzzer_filter_deps`.
+ * - the counters are halved after each sort to follow the traffic.
+ * - skipped stages (the address with `ADDR_ANY`) are not run at all.
+ * - the rate limit waits for the type, the address and the service:
+ *   only the advertisements of the hubs are charged to the buckets.
+ * - the parts of the device (the clock, the address, the catalog and
+ *   the logs) are given by `Env`, the host tests run the same stages.
+ */
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <tuple>
+
+#include "buzzer_adv.h"
+#include "homebuzzer.h"
+
+
+constexpr int BUZZER_FILTER_PERIOD = 1024;  /// advertisements between sorts
+
+enum buzzer_filter_stage : uint8_t {
+    BUZZER_FILTER_TYPE,     /// connectable or directed
+    BUZZER_FILTER_RATE,     /// per-sender token bucket
+    BUZZER_FILTER_ADDR,     /// `BUZZER_PEER_ADDR`
+    BUZZER_FILTER_SERVICE,  /// alert notification service in the UUIDs
+    BUZZER_FILTER_PAYLOAD,  /// a sound for this buzzer
+    BUZZER_FILTER_HISTORY,  /// not played yet
+    BUZZER_FILTER_STAGES
+};
+
+constexpr const char* buzzer_filter_names[BUZZER_FILTER_STAGES] = {
+    "type", "rate", "addr", "service", "payload", "history",
+};
+
+/// stages to be run before each stage, as bit masks.
+constexpr uint8_t buzzer_filter_deps[BUZZER_FILTER_STAGES] = {
+    0,
+    // - the buckets are charged only by the ones from a hub.
+    (1 << BUZZER_FILTER_TYPE) | (1 << BUZZER_FILTER_ADDR) |
+    (1 << BUZZER_FILTER_SERVICE),
+    0,
+    0,
+    // - the hub clock and the latency only from the hub, within the rate.
+    (1 << BUZZER_FILTER_TYPE) | (1 << BUZZER_FILTER_RATE) |
+    (1 << BUZZER_FILTER_ADDR) | (1 << BUZZER_FILTER_SERVICE),
+    // - the sequence is recorded only for the accepted advertisements.
+    (1 << BUZZER_FILTER_HISTORY) - 1,
+};
+
+struct buzzer_filter_stats {
+    uint32_t runs[BUZZER_FILTER_STAGES];
+    uint32_t rejects[BUZZER_FILTER_STAGES];
+    uint64_t cycles[BUZZER_FILTER_STAGES];
+};
+
+struct buzzer_filter_order {
+    uint8_t stages[BUZZER_FILTER_STAGES];
+    int n;
+};
+
+
+/// true if the stage `l` rejects more per cycle than `r`.
+constexpr bool buzzer_filter_better(const buzzer_filter_stats& s,
+                                    int l, int r) {
+    return (uint64_t)s.rejects[l] * (s.cycles[r] + 1) >
+           (uint64_t)s.rejects[r] * (s.cycles[l] + 1);
+}
+
+
+/** order of the stages by the stats, leaving out the stages in `skip`.
+ *  ties keep the order of `buzzer_filter_stage`.
+ */
+constexpr buzzer_filter_order buzzer_filter_sort(
+        const buzzer_filter_stats& s, uint8_t skip
+) {
+    buzzer_filter_order ret = {{}, 0};
+    uint8_t done = skip;
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < BUZZER_FILTER_STAGES; i++) {
+            if (done & (1 << i)) {continue;}
+            if (buzzer_filter_deps[i] & ~done) {continue;}
+            if (best < 0 || buzzer_filter_better(s, i, best)) {best = i;}
+        }
+        if (best < 0) {break;}
+        ret.stages[ret.n++] = best;
+        done |= 1 << best;
+    }
+    return ret;
+}
+
+
+constexpr void buzzer_filter_decay(buzzer_filter_stats& s) {
+    for (int i = 0; i < BUZZER_FILTER_STAGES; i++) {
+        s.runs[i] /= 2;
+        s.rejects[i] /= 2;
+        s.cycles[i] /= 2;
+    }
+}
+
+
+constexpr uint16_t BUZZER_FILTER_UUID = 0x1811;    /// alert notification
+constexpr uint8_t BUZZER_FILTER_ADV_IND = 0;        /// HCI report types
+constexpr uint8_t BUZZER_FILTER_DIR_IND = 1;
+constexpr int BUZZER_FILTER_HISTORY_SEQS = 5;       /// accepted sequences
+
+/// token bucket of a sender.
+struct buzzer_rate_bucket {
+    uint8_t addr[6];
+    int64_t tokens;     /// 1000000 for one advertisement
+    int64_t last;       /// 0 if not used
+};
+
+/// state of the stages, `buzzer_filter_init()` clears it.
+struct buzzer_filter {
+    buzzer_filter_order order;
+    buzzer_filter_stats stats;
+    uint8_t skip;           /// stages not run
+    bool reorder;           /// sort the stages by the stats
+    uint8_t target;         /// `CONFIG_BUZZER_TARGET_ID`
+    int rate;               /// advertisements/sec from a sender
+    int burst;
+    uint32_t n_seen;
+    buzzer_rate_bucket buckets[BUZZER_RATE_SENDERS];
+    buzzer_rate_bucket overflow;    /// for the senders not in the table
+    uint16_t history[BUZZER_FILTER_HISTORY_SEQS];
+    int n_history;
+};
+
+/// an advertisement through the stages.
+struct buzzer_filter_adv {
+    uint8_t event_type;     /// HCI advertising report type
+    const uint8_t* addr;    /// 6 bytes
+    const uint8_t* data;
+    int len;
+    int64_t usec;           /// arrival, 0 until a stage needs it
+    buzzer_adv_rec rec;     /// valid after the payload stage
+    const char* result;     /// name of the sound, if accepted
+};
+
+
+constexpr void buzzer_filter_init(buzzer_filter& f, uint8_t skip,
+                                  bool reorder, uint8_t target, int rate,
+                                  int burst) {
+    f = {};
+    f.order = buzzer_filter_sort({}, skip);
+    f.skip = skip;
+    f.reorder = reorder;
+    f.target = target;
+    f.rate = rate;
+    f.burst = burst;
+}
+
+
+constexpr buzzer_filter_adv buzzer_filter_adv_of(uint8_t event_type,
+                                                 const uint8_t* addr,
+                                                 const uint8_t* data,
+                                                 int len, int64_t usec) {
+    return {event_type, addr, data, len, usec, {-1, 0, 0, 0, false, 0, 0},
+            nullptr};
+}
+
+
+/** per-sender token bucket, returns true if the sender exceeds
+ *  `rate` advertisements/sec.
+ *  a new sender takes an idle entry (its bucket would be full again),
+ *  or shares `overflow` while all the entries are active,
+ *  rotating addresses don't get full buckets by evicting others.
+ */
+constexpr bool buzzer_filter_rate(buzzer_filter& f, const uint8_t* addr,
+                                  int64_t usec) {
+    const int64_t one = 1000000;
+    const int64_t full = f.burst * one;
+    const int64_t idle = full / f.rate;     /// usec to refill
+    auto same = [addr] (const buzzer_rate_bucket& b) {
+        for (int i = 0; i < 6; i++) {
+            if (b.addr[i] != addr[i]) {return false;}
+        }
+        return true;
+    };
+
+    buzzer_rate_bucket* b = nullptr;
+    buzzer_rate_bucket* oldest = &f.buckets[0];
+    for (auto& i : f.buckets) {
+        if (i.last != 0 && same(i)) {
+            b = &i;
+            break;
+        }
+        oldest = i.last < oldest->last ? &i: oldest;
+    }
+    if (b == nullptr) {
+        if (oldest->last == 0 || usec - oldest->last >= idle) {
+            b = oldest;
+            for (int i = 0; i < 6; i++) {b->addr[i] = addr[i];}
+        } else {
+            b = &f.overflow;
+        }
+        if (b->last == 0 || b != &f.overflow) {
+            b->tokens = full;
+            b->last = usec;
+        }
+    }
+    b->tokens = std::min(full, b->tokens + (usec - b->last) * f.rate);
+    b->last = usec;
+    if (b->tokens < one) {return true;}
+    b->tokens -= one;
+    return false;
+}
+
+
+/** true if `seq` was accepted recently, or records it.
+ *  also returns the index of it in the history.
+ */
+constexpr std::tuple<bool, int> buzzer_filter_history(buzzer_filter& f,
+                                                      uint16_t seq) {
+    const int N = BUZZER_FILTER_HISTORY_SEQS;
+    for (int i = 0; i < N; i++) {
+        if (f.history[i] == seq) {return {true, i};}
+    }
+    auto j = f.n_history++;
+    f.n_history = f.n_history >= N ? 0: f.n_history;
+    f.history[j] = seq;
+    return {false, j};
+}
+
+
+/** run the stage, returns true if it rejects the advertisement.
+ *  `Env` has the parts of the device:
+ *
+ *      int64_t now();
+ *      uint32_t cycles();                      /// for the stats
+ *      bool addr(const uint8_t* addr);         /// true to reject
+ *      const char* payload(buzzer_filter_adv& adv);  /// after the decode,
+ *                                              /// the sound name or nullptr
+ *      void trace(buzzer_filter_stage stage, const buzzer_filter_adv& adv,
+ *                 bool rejected, int value);   /// logs of the stage
+ */
+template <class Env>
+bool buzzer_filter_run(buzzer_filter& f, buzzer_filter_stage stage,
+                       buzzer_filter_adv& adv, Env& env) {
+    auto now = [&adv, &env] () {
+        if (adv.usec == 0) {adv.usec = env.now();}
+        return adv.usec;
+    };
+    switch (stage) {
+    case BUZZER_FILTER_TYPE:
+        return adv.event_type != BUZZER_FILTER_ADV_IND &&
+               adv.event_type != BUZZER_FILTER_DIR_IND;
+    case BUZZER_FILTER_RATE: {
+        auto limited = buzzer_filter_rate(f, adv.addr, now());
+        env.trace(stage, adv, limited, 0);
+        return limited;
+    }
+    case BUZZER_FILTER_ADDR:
+        return env.addr(adv.addr);
+    case BUZZER_FILTER_SERVICE: {
+        auto i = buzzer_adv_uuid16(adv.data, adv.len, BUZZER_FILTER_UUID);
+        env.trace(stage, adv, i < 0, i);
+        return i < 0;
+    }
+    case BUZZER_FILTER_PAYLOAD: {
+        now();
+        auto [mfg, len] = buzzer_adv_field(adv.data, adv.len,
+                                           BUZZER_ADV_AD_MFG_DATA);
+        adv.rec = buzzer_adv_decode(mfg, len, f.target);
+        adv.result = env.payload(adv);
+        return adv.result == nullptr;
+    }
+    case BUZZER_FILTER_HISTORY: {
+        auto [dup, i] = buzzer_filter_history(f, adv.rec.seq);
+        env.trace(stage, adv, dup, i);
+        return dup;
+    }
+    default:
+        break;
+    }
+    return true;
+}
+
+
+/** run the stages in the order until one rejects the advertisement,
+ *  returns true if it is accepted.
+ *  sorts the stages every `BUZZER_FILTER_PERIOD` advertisements.
+ */
+template <class Env>
+bool buzzer_filter_pass(buzzer_filter& f, buzzer_filter_adv& adv, Env& env) {
+    f.n_seen++;
+    bool rejected = false;
+    for (int i = 0; i < f.order.n && !rejected; i++) {
+        auto stage = (buzzer_filter_stage)f.order.stages[i];
+        auto t = env.cycles();
+        rejected = buzzer_filter_run(f, stage, adv, env);
+        f.stats.cycles[stage] += (uint32_t)(env.cycles() - t);
+        f.stats.runs[stage]++;
+        f.stats.rejects[stage] += rejected ? 1 : 0;
+    }
+    if (f.n_seen % BUZZER_FILTER_PERIOD == 0) {
+        if (f.reorder) {
+            f.order = buzzer_filter_sort(f.stats, f.skip);
+        }
+        buzzer_filter_decay(f.stats);
+    }
+    return !rejected;
+}
+
+
+namespace buzzer_filter_check {
+
+constexpr buzzer_filter_order fixed = buzzer_filter_sort({}, 0);
+static_assert(fixed.n == BUZZER_FILTER_STAGES);
+static_assert(fixed.stages[0] == BUZZER_FILTER_TYPE);
+static_assert(fixed.stages[1] == BUZZER_FILTER_ADDR);
+static_assert(fixed.stages[2] == BUZZER_FILTER_SERVICE);
+static_assert(fixed.stages[3] == BUZZER_FILTER_RATE);
+static_assert(fixed.stages[5] == BUZZER_FILTER_HISTORY);
+
+// - a scan log: 80% beacons without the service (200 cycles),
+//   6% non-connectable (10 cycles), many rate-limited (300 cycles).
+constexpr buzzer_filter_stats scan = {
+    {100, 100, 100, 100, 100, 100},
+    {6, 90, 0, 80, 50, 10},
+    {1000, 30000, 5000, 20000, 50000, 2000},
+};
+constexpr buzzer_filter_order sorted = buzzer_filter_sort(scan, 0);
+static_assert(sorted.stages[0] == BUZZER_FILTER_TYPE);
+static_assert(sorted.stages[1] == BUZZER_FILTER_SERVICE);
+static_assert(sorted.stages[2] == BUZZER_FILTER_ADDR);
+// - the rate waits for the address and the service, even with more
+//   rejects per cycle; the payload and the history stay last.
+static_assert(sorted.stages[3] == BUZZER_FILTER_RATE);
+static_assert(sorted.stages[4] == BUZZER_FILTER_PAYLOAD);
+static_assert(sorted.stages[5] == BUZZER_FILTER_HISTORY);
+
+constexpr buzzer_filter_order any = buzzer_filter_sort(
+        scan, 1 << BUZZER_FILTER_ADDR);
+static_assert(any.n == BUZZER_FILTER_STAGES - 1);
+static_assert(any.stages[1] == BUZZER_FILTER_SERVICE);
+static_assert(any.stages[2] == BUZZER_FILTER_RATE);
+static_assert(any.stages[3] == BUZZER_FILTER_PAYLOAD);
+
+/// advertisements accepted from a sender at `per_sec`, in 2 sec.
+constexpr int rated(int per_sec) {
+    buzzer_filter f = {};
+    buzzer_filter_init(f, 0, false, 1, 20, 20);
+    const uint8_t addr[6] = {1, 2, 3, 4, 5, 6};
+    int ret = 0;
+    for (int64_t t = 1; t <= 2000000; t += 1000000 / per_sec) {
+        ret += buzzer_filter_rate(f, addr, t) ? 0 : 1;
+    }
+    return ret;
+}
+static_assert(rated(10) == 20);
+// - the burst, then the rate.
+static_assert(rated(1000) >= 20 + 2 * 20 - 1 && rated(1000) <= 20 + 2 * 20);
+
+constexpr bool history() {
+    buzzer_filter f = {};
+    buzzer_filter_init(f, 0, false, 1, 20, 20);
+    for (uint16_t seq = 1; seq <= BUZZER_FILTER_HISTORY_SEQS; seq++) {
+        if (std::get<0>(buzzer_filter_history(f, seq))) {return false;}
+    }
+    // - the oldest one is out of the history.
+    return std::get<0>(buzzer_filter_history(f, 5)) &&
+           !std::get<0>(buzzer_filter_history(f, 6)) &&
+           !std::get<0>(buzzer_filter_history(f, 1));
+}
+static_assert(history());
+
+}  // namespace buzzer_filter_check
@@ -0,0 +1,106 @@
+/** @file buzzer_log.cpp
+ *
+ * Home Buzzer - deferred binary logging
+ * ==================================
+ *
+ */
+#include <stdio.h>
+#include <atomic>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "buzzer_log.h"
+#include "homebuzzer.h"
+
+
+#define BUZZER_BLOG_TASKTAG "BUZZER-LOG"
+
+struct buzzer_blog_rec {
+    uint32_t msec;
+    uint8_t level;
+    uint8_t id;
+    uint32_t args[BUZZER_BLOG_N_ARGS];
+};
+
+static const char tag[] = TAG_BUZZER;
+
+#define BUZZER_BLOG_FMT(id) BUZZER_BLOG_FMT_##id,
+static const char* const formats[BUZZER_BLOG_MAX] = {
+    BUZZER_BLOG_IDS(BUZZER_BLOG_FMT)
+};
+#undef BUZZER_BLOG_FMT
+
+static buzzer_blog_rec ring[BUZZER_BLOG_N_RECORDS];
+static std::atomic<uint32_t> ring_head(0);  /// written by the producer
+static std::atomic<uint32_t> ring_tail(0);  /// written by the log task
+static std::atomic<uint32_t> n_dropped(0);
+
+#if CONFIG_BUZZER_BLOG_DEFERRED
+static StaticTask_t task_buf;
+static StackType_t task_stack[BUZZER_BLOG_STACK_SIZE];
+#endif
+
+
+void buzzer_blog_put(esp_log_level_t level, buzzer_blog_id id,
+                     const uint32_t (&args)[BUZZER_BLOG_N_ARGS]) {
+    auto head = ring_head.load(std::memory_order_relaxed);
+    auto tail = ring_tail.load(std::memory_order_acquire);
+    if (head - tail >= BUZZER_BLOG_N_RECORDS) {
+        n_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& rec = ring[head & (BUZZER_BLOG_N_RECORDS - 1)];
+    rec.msec = esp_log_timestamp();
+    rec.level = level;
+    rec.id = id;
+    for (int i = 0; i < BUZZER_BLOG_N_ARGS; i++) {
+        rec.args[i] = args[i];
+    }
+    ring_head.store(head + 1, std::memory_order_release);
+}
+
+
+static void buzzer_blog_print(const buzzer_blog_rec& rec) {
+    char line[80];
+    snprintf(line, sizeof(line), formats[rec.id],
+             rec.args[0], rec.args[1], rec.args[2]);
+    ESP_LOG_LEVEL((esp_log_level_t)rec.level, tag, "[%u] %s",
+                  (unsigned)rec.msec, line);
+}
+
+
+static void buzzer_blog_task(void* params) {
+    uint32_t dropped = 0;
+    buzzer_report_task();
+    for (;;) {
+        auto tail = ring_tail.load(std::memory_order_relaxed);
+        auto head = ring_head.load(std::memory_order_acquire);
+        if (tail == head) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        auto rec = ring[tail & (BUZZER_BLOG_N_RECORDS - 1)];
+        ring_tail.store(tail + 1, std::memory_order_release);
+        buzzer_blog_print(rec);
+
+        auto n = n_dropped.load(std::memory_order_relaxed);
+        if (n != dropped) {
+            ESP_LOGW(tag, "buzzer_blog: %u records dropped",
+                     (unsigned)(n - dropped));
+            dropped = n;
+        }
+    }
+}
+
+
+void buzzer_blog_init(void) {
+    static_assert((BUZZER_BLOG_N_RECORDS & (BUZZER_BLOG_N_RECORDS - 1)) == 0,
+                  "BUZZER_BLOG_N_RECORDS must be power of 2");
+    #if CONFIG_BUZZER_BLOG_DEFERRED
+    xTaskCreateStaticPinnedToCore(buzzer_blog_task, BUZZER_BLOG_TASKTAG,
+                                  BUZZER_BLOG_STACK_SIZE, nullptr, 1,
+                                  task_stack, &task_buf, tskNO_AFFINITY);
+    #endif
+}
@@ -0,0 +1,81 @@
+/** @file buzzer_log.h
+ *
+ * Home Buzzer - deferred binary logging
+ * ==========================================
+ *
+ * log sites on the advertisement path store only an ID and arguments
+ * to a lock-free ring, and the low priority log task formats them later.
+ *
+ * - levels are selected by `BUZZER_BLOG_LEVEL` at compile time,
+ *   disabled sites are removed by the compiler.
+ * - the ring has a single producer: the NimBLE host task.
+ * - `BUZZER_BLOG_DEFERRED=n` prints by ESP_LOG directly (for comparison).
+ */
+#pragma once
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "homebuzzer.h"
+
+
+#define BUZZER_BLOG_N_ARGS 3
+#define BUZZER_BLOG_N_RECORDS 64    /// must be power of 2
+#define BUZZER_BLOG_STACK_SIZE 3072
+
+#define BUZZER_BLOG_FMT_ADDR_ANY    "buzzer_chk_addr: any: %06x%06x"
+#define BUZZER_BLOG_FMT_SERV_FOUND  "buzzer_chk_serv: found at %d"
+#define BUZZER_BLOG_FMT_SERV_NONE   "buzzer_from_adv: dont have service."
+#define BUZZER_BLOG_FMT_HIST_FOUND  "buzzer_chk_hist: found at %d(%d)"
+#define BUZZER_BLOG_FMT_HIST_UPDATE "buzzer_chk_hist: update to %d(%d)"
+#define BUZZER_BLOG_FMT_ADV_PARSE   "buzzer_from_adv: malformed fields: %d bytes"
+#define BUZZER_BLOG_FMT_RATE_LIMIT  "buzzer_chk_rate: limited %06x%06x"
+
+#define BUZZER_BLOG_IDS(X) \
+    X(ADDR_ANY) \
+    X(SERV_FOUND) \
+    X(SERV_NONE) \
+    X(HIST_FOUND) \
+    X(HIST_UPDATE) \
+    X(ADV_PARSE) \
+    X(RATE_LIMIT)
+
+#define BUZZER_BLOG_ENUM(id) BUZZER_BLOG_##id,
+enum buzzer_blog_id : uint8_t {
+    BUZZER_BLOG_IDS(BUZZER_BLOG_ENUM)
+    BUZZER_BLOG_MAX
+};
+#undef BUZZER_BLOG_ENUM
+
+
+extern void buzzer_blog_init(void);
+extern void buzzer_blog_put(esp_log_level_t level, buzzer_blog_id id,
+                            const uint32_t (&args)[BUZZER_BLOG_N_ARGS]);
+
+
+template <esp_log_level_t L, typename... T>
+static inline void buzzer_blog(buzzer_blog_id id, T... args) {
+    static_assert(sizeof...(T) <= BUZZER_BLOG_N_ARGS, "too many arguments");
+    if constexpr (L <= CONFIG_BUZZER_BLOG_LEVEL) {
+        const uint32_t tmp[BUZZER_BLOG_N_ARGS] = {(uint32_t)args...};
+        buzzer_blog_put(L, id, tmp);
+    }
+}
+
+
+#if CONFIG_BUZZER_BLOG_DEFERRED
+#define BUZZER_BLOG(level, id, ...) \
+    buzzer_blog<level>(BUZZER_BLOG_##id, ##__VA_ARGS__)
+#else
+#define BUZZER_BLOG(level, id, ...) do { \
+    if constexpr (level <= CONFIG_BUZZER_BLOG_LEVEL) { \
+        ESP_LOG_LEVEL_LOCAL(level, TAG_BUZZER, BUZZER_BLOG_FMT_##id, \
+                            ##__VA_ARGS__); \
+    } \
+} while (0)
+#endif
+
+#define BUZZER_BLOGE(id, ...) BUZZER_BLOG(ESP_LOG_ERROR, id, ##__VA_ARGS__)
+#define BUZZER_BLOGI(id, ...) BUZZER_BLOG(ESP_LOG_INFO, id, ##__VA_ARGS__)
+#define BUZZER_BLOGD(id, ...) BUZZER_BLOG(ESP_LOG_DEBUG, id, ##__VA_ARGS__)
@@ -0,0 +1,86 @@
+/** @file buzzer_storm.cpp
+ *
+ * Home Buzzer - advertisement storm generator
+ * ==================================
+ *
+ * replays synthetic advertisements through `buzzer_from_advertise()`
+ * at boot, and reports the throughput, the p99 handling time
+ * and the time per rejected advertisement.
+ *
+ * - the advertisements are generated by `buzzer_storm.h`.
+ * - the state of the advertisement path is cleared after the storm.
+ *
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "rom/ets_sys.h"
+
+#include "buzzer_storm.h"
+#include "homebuzzer.h"
+
+
+#if CONFIG_BUZZER_ADV_STORM
+#define BUZZER_STORM_BUCKET_NS 250  /// resolution of the histogram
+#define BUZZER_STORM_BUCKETS 256
+
+static const char tag[] = TAG_BUZZER;
+static uint32_t histogram[BUZZER_STORM_BUCKETS + 1];
+
+
+extern "C" void buzzer_adv_storm(void) {
+    buzzer_storm storm;
+    buzzer_storm_init(storm, 0x1234567);
+    memset(histogram, 0, sizeof(histogram));
+
+    const int n_total = CONFIG_BUZZER_ADV_STORM_COUNT;
+    const uint32_t mhz = ets_get_cpu_frequency();
+    uint64_t cycles = 0;
+    uint64_t rejected_cycles = 0;
+    int n_rejected = 0;
+    for (int i = 0; i < n_total; i++) {
+        buzzer_storm_next(storm, i);
+        struct ble_gap_disc_desc disc = {};
+        disc.event_type = storm.event_type;
+        memcpy(disc.addr.val, storm.addr, sizeof(disc.addr.val));
+        disc.data = storm.data;
+        disc.length_data = storm.len;
+
+        buzzer_req req;
+        auto t = esp_cpu_get_cycle_count();
+        auto name = buzzer_from_advertise(&disc, &req);
+        t = esp_cpu_get_cycle_count() - t;
+
+        cycles += t;
+        if (name == nullptr) {
+            rejected_cycles += t;
+            n_rejected++;
+        }
+        auto ns = t * 1000 / mhz;
+        histogram[std::min<uint32_t>(ns / BUZZER_STORM_BUCKET_NS,
+                                     BUZZER_STORM_BUCKETS)]++;
+    }
+
+    uint32_t n = 0;
+    int p99 = 0;
+    for (; p99 <= BUZZER_STORM_BUCKETS; p99++) {
+        n += histogram[p99];
+        if (n * 100 >= (uint32_t)n_total * 99) {break;}
+    }
+    auto usec = cycles / mhz;
+    ESP_LOGI(tag, "adv-storm: %d advs in %d usec, %d advs/s, "
+             "p99 < %d nsec%s", n_total, (int)usec,
+             usec > 0 ? (int)(n_total * 1000000ULL / usec) : 0,
+             (p99 + 1) * BUZZER_STORM_BUCKET_NS,
+             p99 >= BUZZER_STORM_BUCKETS ? " (overflow)" : "");
+    ESP_LOGI(tag, "adv-storm: %d rejected, %d nsec/reject", n_rejected,
+             n_rejected > 0 ?
+             (int)(rejected_cycles * 1000 / mhz / n_rejected) : 0);
+    buzzer_adv_report(true);
+    buzzer_adv_reset();
+}
+#endif
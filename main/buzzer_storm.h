@@ -0,0 +1,122 @@
+/** @file buzzer_storm.h
+ *
+ * Home Buzzer - advertisement storm generator
+ * ==========================================
+ *
+ * the synthetic advertisements of `buzzer_adv_storm()`, also replayed
+ * through the filter by the host tests.
+ *
+ * - 3 in 5 are hubs from `BUZZER_STORM_SENDERS` addresses, the sound
+ *   sometimes out of the catalog.
+ * - 1 in 5 are hubs from random addresses (a rotating private address),
+ *   to the overflow bucket of the rate limiter.
+ * - 1 in 5 are beacons from random addresses, without the service.
+ * - 1 in 16 are non-connectable.
+ */
+#pragma once
+#include <stdint.h>
+
+#include "buzzer_filter.h"
+#include "homebuzzer.h"
+
+
+/// flags, alert notification service, manufacturer data (legacy).
+constexpr uint8_t buzzer_storm_hub[] = {0x02, 0x01, 0x06,
+                                        0x03, 0x03, 0x11, 0x18,
+                                        0x06, 0xff, 0xff, 0xff, 0x00, 0x00,
+                                        0xff};
+constexpr uint8_t buzzer_storm_beacon[] = {0x02, 0x01, 0x06,
+                                           0x05, 0xff, 0x4c, 0x00, 0x02,
+                                           0x15};
+
+/// the generator and its last advertisement.
+struct buzzer_storm {
+    uint32_t seed;
+    uint8_t event_type;
+    uint8_t addr[6];
+    uint8_t hub[sizeof(buzzer_storm_hub)];
+    const uint8_t* data;
+    int len;
+};
+
+
+constexpr void buzzer_storm_init(buzzer_storm& s, uint32_t seed) {
+    s = {};
+    s.seed = seed;
+    for (int i = 0; i < (int)sizeof(s.hub); i++) {
+        s.hub[i] = buzzer_storm_hub[i];
+    }
+}
+
+
+/// true if the address is one of the `BUZZER_STORM_SENDERS` hubs.
+constexpr bool buzzer_storm_sender(const uint8_t* addr) {
+    return addr[0] < BUZZER_STORM_SENDERS && addr[1] == 0 && addr[2] == 0 &&
+           addr[3] == 0 && addr[4] == 0 && addr[5] == 0xC0;
+}
+
+
+/// the `i`-th advertisement of the storm.
+constexpr void buzzer_storm_next(buzzer_storm& s, int i) {
+    auto next = [&s] () {
+        s.seed ^= s.seed << 13;
+        s.seed ^= s.seed >> 17;
+        s.seed ^= s.seed << 5;
+        return s.seed;
+    };
+    auto r = next();
+    s.event_type = (r & 0xF) == 0 ? 3 /* non-connectable */
+                                  : BUZZER_FILTER_ADV_IND;
+    for (auto& a : s.addr) {a = 0;}
+    s.addr[0] = (r >> 8) % BUZZER_STORM_SENDERS;
+    s.addr[5] = 0xC0;
+    auto kind = (r >> 16) % 5;
+    if (kind < 2) {
+        auto a = next();
+        s.addr[1] = a;
+        s.addr[2] = a >> 8;
+        s.addr[3] = a >> 16 | 1;    // - not one of the senders.
+    }
+    if (kind == 0) {
+        s.data = buzzer_storm_beacon;
+        s.len = sizeof(buzzer_storm_beacon);
+        return;
+    }
+    s.hub[11] = (r >> 24) % 12;     // - sometimes out of the catalog.
+    s.hub[12] = i & 0xFF;
+    s.data = s.hub;
+    s.len = sizeof(s.hub);
+}
+
+
+namespace buzzer_storm_check {
+
+struct mix {
+    int beacons;
+    int rotating;
+    int senders;
+};
+
+constexpr mix count(int n) {
+    buzzer_storm s = {};
+    buzzer_storm_init(s, 0x1234567);
+    mix ret = {0, 0, 0};
+    for (int i = 0; i < n; i++) {
+        buzzer_storm_next(s, i);
+        if (s.data == buzzer_storm_beacon) {
+            ret.beacons++;
+        } else if (buzzer_storm_sender(s.addr)) {
+            ret.senders++;
+        } else {
+            ret.rotating++;
+        }
+    }
+    return ret;
+}
+
+constexpr auto counted = count(1000);
+static_assert(counted.beacons > 150 && counted.beacons < 250);
+static_assert(counted.rotating > 150 && counted.rotating < 250);
+static_assert(counted.senders > 550 && counted.senders < 650);
+
+}  // namespace buzzer_storm_check
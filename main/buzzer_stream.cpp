@@ -0,0 +1,143 @@
+/** @file buzzer_stream.cpp
+ *
+ * Home Buzzer - live streaming
+ * ==================================
+ *
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "buzzer_clock.h"
+#include "buzzer_dac.h"
+#include "buzzer_stream.h"
+#include "homebuzzer.h"
+
+
+#if CONFIG_BUZZER_STREAM
+#define BUZZER_STREAM_RETRY 25  /// frames between the play requests
+
+static const char tag[] = TAG_BUZZER;
+
+/// for the jitter buffer, shared by the writer task and the player task.
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static buzzer_jitter jitter;
+static int16_t samples[BUZZER_JITTER_SLOTS][BUZZER_STREAM_FRAME];
+static uint16_t captures[BUZZER_JITTER_SLOTS];  /// hub msec of the capture
+
+static int16_t last[BUZZER_STREAM_FRAME];   /// the last frame to conceal
+static std::atomic<bool> requested(false);
+static int n_puts = 0;
+static int64_t latency_sum = 0;
+static int64_t latency_max = 0;
+static int n_latency = 0;
+
+
+void buzzer_stream_put(const uint8_t* src, int len) {
+    auto now = esp_timer_get_time();
+    auto payload = &src[BUZZER_STREAM_OFS_SAMPLES];
+    auto n = len - BUZZER_STREAM_OFS_SAMPLES;
+    int16_t pcm[BUZZER_STREAM_FRAME];
+    if (n == BUZZER_STREAM_FRAME * (int)sizeof(int16_t) &&
+            src[1] == BUZZER_STREAM_PCM) {
+        memcpy(pcm, payload, sizeof(pcm));
+    } else if (n == BUZZER_STREAM_ADPCM_BYTES &&
+               src[1] == BUZZER_STREAM_ADPCM) {
+        buzzer_adpcm_decode(payload, pcm);
+    } else {
+        ESP_LOGE(tag, "buzzer_stream: invalid frame %d, %d bytes",
+                 len > 1 ? src[1] : -1, len);
+        return;
+    }
+    uint16_t seq = src[2] | (src[3] << 8);
+    uint16_t ts = src[4] | (src[5] << 8);
+
+    taskENTER_CRITICAL(&lock);
+    auto slot = buzzer_jitter_put(jitter, seq, ts, now);
+    if (slot >= 0) {
+        memcpy(samples[slot], pcm, sizeof(pcm));
+        captures[slot] = ts;
+    }
+    taskEXIT_CRITICAL(&lock);
+
+    // - start the player, retry while an other sound is playing.
+    if (!requested.load() && n_puts++ % BUZZER_STREAM_RETRY == 0) {
+        buzzer_req req = {BUZZER_STREAM_SOUND, 0, 255, 0};
+        if (!buzzer(&req)) {
+            requested.store(true);
+        }
+    }
+}
+
+
+bool buzzer_stream_get(int16_t* dst) {
+    auto now = esp_timer_get_time();
+    uint16_t capture = 0;
+    taskENTER_CRITICAL(&lock);
+    auto idle = now - jitter.last_arrival > BUZZER_STREAM_IDLE_USEC;
+    auto [out, slot] = buzzer_jitter_get(jitter);
+    if (out == buzzer_jitter_out::PLAY) {
+        memcpy(dst, samples[slot], sizeof(samples[slot]));
+        capture = captures[slot];
+    }
+    taskEXIT_CRITICAL(&lock);
+
+    switch (out) {
+    case buzzer_jitter_out::PLAY:
+        memcpy(last, dst, sizeof(last));
+        // - the frame goes to the DMA queue now, and to the speaker after
+        //   the queue, from the capture on the hub; only with the hub clock
+        //   from the recent timed advertisements.
+        if (buzzer_clock_synced(now)) {
+            auto latency = now + buzzer_dac_queue_usec(BUZZER_STREAM_RATE) -
+                           buzzer_clock_to_local(capture);
+            latency_sum += latency;
+            latency_max = std::max(latency_max, latency);
+            n_latency++;
+        }
+        return true;
+    case buzzer_jitter_out::CONCEAL:
+        if (idle) {return false;}
+        for (auto& i : last) {i /= 2;}
+        memcpy(dst, last, sizeof(last));
+        return true;
+    case buzzer_jitter_out::WAIT:
+        if (idle) {return false;}
+        memset(dst, 0, sizeof(last));
+        return true;
+    }
+    return false;
+}
+
+
+void buzzer_stream_report(void) {
+    taskENTER_CRITICAL(&lock);
+    auto j = jitter;
+    jitter = {};
+    taskEXIT_CRITICAL(&lock);
+
+    ESP_LOGI(tag, "buzzer_stream: %u frames, jitter %d msec, target %d "
+             "frames, concealed %u, underruns %u, late %u, dropped %u",
+             (unsigned)j.n_frames, buzzer_jitter_usec(j) / 1000, j.target,
+             (unsigned)j.n_concealed, (unsigned)j.n_underruns,
+             (unsigned)j.n_late, (unsigned)j.n_dropped);
+    if (n_latency > 0) {
+        ESP_LOGI(tag, "buzzer_stream: latency avg %d msec, max %d msec",
+                 (int)(latency_sum / n_latency / 1000),
+                 (int)(latency_max / 1000));
+    } else {
+        ESP_LOGI(tag, "buzzer_stream: latency unknown, hub clock not synced");
+    }
+    memset(last, 0, sizeof(last));
+    latency_sum = latency_max = 0;
+    n_latency = 0;
+    n_puts = 0;
+    requested.store(false);
+}
+#endif
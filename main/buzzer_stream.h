@@ -0,0 +1,320 @@
+/** @file buzzer_stream.h
+ *
+ * Home Buzzer - live streaming
+ * ==========================================
+ *
+ * the hub streams announcements by the upload channel (`buzzer_upload.h`),
+ * an SDU for each 20 msec frame of 8 kHz mono:
+ *
+ * stream  | 0: 0x05 | 1: codec | 2-3: seq | 4-5: hub clock of the capture |
+ *         | 6-: samples |
+ * PCM     | 320 bytes of 16-bit samples |
+ * ADPCM   | 0-1: predictor | 2: step index | 3: 0 | 4-83: IMA ADPCM,
+ *         | low nibble first |
+ *
+ * - the jitter buffer estimates the inter-arrival jitter as RFC 3550,
+ *   and buffers enough frames for 4 times of the jitter.
+ * - a lost frame is concealed by the last frame with the half amplitude,
+ *   an empty buffer is an underrun and the buffer is filled again.
+ * - if the buffer grows over the target, a frame is dropped
+ *   to keep the latency.
+ * - the stream ends without frames for `BUZZER_STREAM_IDLE_USEC`.
+ */
+#pragma once
+#include <stdint.h>
+#include <tuple>
+
+#include "buzzer_synth.h"
+#include "homebuzzer.h"
+
+
+constexpr int BUZZER_STREAM_RATE = 8000;
+constexpr int BUZZER_STREAM_FRAME = 160;             /// samples
+constexpr int BUZZER_STREAM_FRAME_USEC = 20000;
+constexpr int BUZZER_STREAM_IDLE_USEC = 500000;
+constexpr int BUZZER_JITTER_SLOTS = 16;
+constexpr int BUZZER_JITTER_MIN = 2;                  /// frames
+
+constexpr uint8_t BUZZER_STREAM_PCM = 0;
+constexpr uint8_t BUZZER_STREAM_ADPCM = 1;
+constexpr int BUZZER_STREAM_OFS_SAMPLES = 6;
+constexpr int BUZZER_STREAM_ADPCM_BYTES = 4 + BUZZER_STREAM_FRAME / 2;
+
+static_assert(BUZZER_STREAM_FRAME * 1000000 / BUZZER_STREAM_RATE ==
+              BUZZER_STREAM_FRAME_USEC);
+
+
+enum class buzzer_jitter_out {
+    PLAY,       /// play the slot
+    CONCEAL,    /// the frame is lost
+    WAIT,       /// filling the buffer
+};
+
+/// state of the jitter buffer, without the samples.
+struct buzzer_jitter {
+    bool started;
+    bool playing;
+    uint16_t next;          /// seq to play
+    uint16_t newest;        /// largest seq received
+    uint16_t last_ts;       /// capture time (hub msec) of `newest`
+    int64_t last_arrival;   /// arrival time (usec) of `newest`
+    int32_t jitter16;       /// jitter (usec) x 16
+    int target;             /// frames to buffer
+    uint16_t seqs[BUZZER_JITTER_SLOTS];
+    bool valid[BUZZER_JITTER_SLOTS];
+
+    uint32_t n_frames;
+    uint32_t n_late;        /// arrived after the playout
+    uint32_t n_concealed;
+    uint32_t n_underruns;
+    uint32_t n_dropped;     /// dropped to keep the latency
+};
+
+
+constexpr int buzzer_jitter_usec(const buzzer_jitter& j) {
+    return j.jitter16 / 16;
+}
+
+
+/** a frame arrived, return the slot to store the samples,
+ *  or -1 if it is too late.
+ */
+constexpr int buzzer_jitter_put(buzzer_jitter& j, uint16_t seq,
+                                uint16_t ts, int64_t arrival) {
+    if (!j.started) {
+        j = {};
+        j.started = true;
+        j.next = j.newest = seq;
+        j.last_ts = ts;
+        j.last_arrival = arrival;
+        j.target = BUZZER_JITTER_MIN;
+    }
+    if ((int16_t)(seq - j.next) < 0) {
+        j.n_late++;
+        return -1;
+    }
+    if ((int16_t)(seq - j.newest) > 0) {
+        // - RFC 3550: J += (|D| - J) / 16, from the transit time difference.
+        int64_t d = (arrival - j.last_arrival) -
+                    (int16_t)(ts - j.last_ts) * 1000LL;
+        d = d < 0 ? -d : d;
+        j.jitter16 += (int32_t)(d - j.jitter16 / 16);
+        j.newest = seq;
+        j.last_ts = ts;
+        j.last_arrival = arrival;
+
+        auto target = 1 + (4 * buzzer_jitter_usec(j) +
+                           BUZZER_STREAM_FRAME_USEC - 1) /
+                          BUZZER_STREAM_FRAME_USEC;
+        j.target = target < BUZZER_JITTER_MIN ? BUZZER_JITTER_MIN
+                 : target > BUZZER_JITTER_SLOTS - 2 ? BUZZER_JITTER_SLOTS - 2
+                 : target;
+    }
+    while ((int16_t)(j.newest - j.next) >= BUZZER_JITTER_SLOTS) {
+        j.valid[j.next % BUZZER_JITTER_SLOTS] = false;
+        j.next++;
+        j.n_dropped++;
+    }
+    auto slot = seq % BUZZER_JITTER_SLOTS;
+    j.seqs[slot] = seq;
+    j.valid[slot] = true;
+    j.n_frames++;
+    return slot;
+}
+
+
+/// the next frame to play, every `BUZZER_STREAM_FRAME_USEC`.
+constexpr std::tuple<buzzer_jitter_out, int> buzzer_jitter_get(
+        buzzer_jitter& j) {
+    if (!j.started) {return {buzzer_jitter_out::WAIT, -1};}
+    int depth = (int16_t)(j.newest - j.next) + 1;
+    if (!j.playing) {
+        if (depth < j.target) {return {buzzer_jitter_out::WAIT, -1};}
+        j.playing = true;
+    }
+    if (depth < 1) {
+        j.n_underruns++;
+        j.playing = false;
+        return {buzzer_jitter_out::WAIT, -1};
+    }
+    if (depth > j.target + 2) {
+        j.valid[j.next % BUZZER_JITTER_SLOTS] = false;
+        j.next++;
+        j.n_dropped++;
+    }
+    auto slot = j.next % BUZZER_JITTER_SLOTS;
+    auto seq = j.next++;
+    if (j.valid[slot] && j.seqs[slot] == seq) {
+        j.valid[slot] = false;
+        return {buzzer_jitter_out::PLAY, slot};
+    }
+    j.n_concealed++;
+    return {buzzer_jitter_out::CONCEAL, -1};
+}
+
+
+constexpr int8_t buzzer_adpcm_index[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8,
+};
+constexpr int16_t buzzer_adpcm_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+    41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+    190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+    20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+/// IMA ADPCM decoder state.
+struct buzzer_adpcm {
+    int predictor;
+    int index;
+};
+
+
+constexpr int16_t buzzer_adpcm_decode1(buzzer_adpcm& s, uint8_t code) {
+    int step = buzzer_adpcm_steps[s.index];
+    int diff = step >> 3;
+    if (code & 4) {diff += step;}
+    if (code & 2) {diff += step >> 1;}
+    if (code & 1) {diff += step >> 2;}
+    s.predictor += (code & 8) ? -diff : diff;
+    s.predictor = s.predictor > 32767 ? 32767
+                : s.predictor < -32768 ? -32768 : s.predictor;
+    s.index += buzzer_adpcm_index[code & 0xF];
+    s.index = s.index < 0 ? 0 : s.index > 88 ? 88 : s.index;
+    return (int16_t)s.predictor;
+}
+
+
+/// decode a frame of `BUZZER_STREAM_ADPCM_BYTES`.
+constexpr void buzzer_adpcm_decode(const uint8_t* src, int16_t* dst) {
+    buzzer_adpcm s = {(int16_t)(src[0] | (src[1] << 8)), src[2] % 89};
+    for (int i = 0; i < BUZZER_STREAM_FRAME / 2; i++) {
+        dst[i * 2] = buzzer_adpcm_decode1(s, src[4 + i] & 0xF);
+        dst[i * 2 + 1] = buzzer_adpcm_decode1(s, src[4 + i] >> 4);
+    }
+}
+
+
+/// a stream frame arrived from the hub.
+extern void buzzer_stream_put(const uint8_t* src, int len);
+
+/** the next frame to play, return false at the end of the stream.
+ *  also measures the latency from the capture to the speaker.
+ */
+extern bool buzzer_stream_get(int16_t* dst);
+
+/// report the statistics of the stream and reset it.
+extern void buzzer_stream_report(void);
+
+
+namespace buzzer_stream_check {
+
+struct result {
+    uint32_t played;
+    uint32_t concealed;
+    uint32_t underruns;
+    uint32_t late;
+    uint32_t dropped;
+    int target;
+    int jitter_usec;
+};
+
+/** play 4 sec of the stream, the frames arrive with a random delay
+ *  up to `jitter_ms` and every `loss`-th frame is lost.
+ */
+constexpr result simulate(int jitter_ms, int loss, uint32_t seed) {
+    constexpr int n = 200;
+    constexpr int base_ms = 30;     /// delay of the link
+    int arrival[n] = {};
+    for (int i = 0; i < n; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        arrival[i] = i * 20 + base_ms + (int)(seed % (jitter_ms + 1));
+        if (loss > 0 && i % loss == loss - 1) {arrival[i] = -1;}
+    }
+
+    buzzer_jitter j{};
+    result ret{};
+    int t_play = -1;
+    const int t_end = n * 20 + base_ms + jitter_ms + 20 * BUZZER_JITTER_SLOTS;
+    for (int t = 0; t < t_end && (int16_t)(j.next - n) < 0; t++) {
+        int lo = (t - base_ms - jitter_ms) / 20 - 1;
+        int hi = (t - base_ms) / 20 + 1;
+        for (int i = lo < 0 ? 0 : lo; i < n && i <= hi; i++) {
+            if (arrival[i] == t) {buzzer_jitter_put(j, i, i * 20, t * 1000LL);}
+        }
+        if (j.started && t_play < 0) {t_play = t;}
+        if (t_play < 0 || (t - t_play) % 20 != 0) {continue;}
+        auto [out, slot] = buzzer_jitter_get(j);
+        ret.played += out == buzzer_jitter_out::PLAY;
+    }
+    ret.concealed = j.n_concealed;
+    ret.underruns = j.n_underruns;
+    ret.late = j.n_late;
+    ret.dropped = j.n_dropped;
+    ret.target = j.target;
+    ret.jitter_usec = buzzer_jitter_usec(j);
+    return ret;
+}
+
+// - no jitter: the minimum buffer, no loss.
+static_assert(simulate(0, 0, 1).played == 200);
+static_assert(simulate(0, 0, 1).target == BUZZER_JITTER_MIN);
+static_assert(simulate(0, 0, 1).underruns == 0);
+// - jitter up to 40 msec: the buffer grows, and nothing is late.
+static_assert(simulate(40, 0, 1).target > BUZZER_JITTER_MIN);
+static_assert(simulate(40, 0, 1).late == 0);
+static_assert(simulate(40, 0, 777).late == 0);
+static_assert(simulate(40, 0, 777).concealed == 0);
+// - jitter up to 80 msec: less than 5% late or concealed.
+static_assert(simulate(80, 0, 1).late + simulate(80, 0, 1).concealed < 10);
+// - 5% loss: the lost frames are concealed.
+static_assert(simulate(5, 20, 1).concealed == 9);
+static_assert(simulate(5, 20, 1).played == 190);
+
+
+/// IMA ADPCM encoder as the hub.
+constexpr void encode(const int16_t* src, uint8_t* dst) {
+    buzzer_adpcm s = {src[0], 0};
+    dst[0] = src[0] & 0xFF;
+    dst[1] = (src[0] >> 8) & 0xFF;
+    dst[2] = 0;
+    dst[3] = 0;
+    for (int i = 0; i < BUZZER_STREAM_FRAME; i++) {
+        int step = buzzer_adpcm_steps[s.index];
+        int diff = src[i] - s.predictor;
+        uint8_t code = diff < 0 ? 8 : 0;
+        diff = diff < 0 ? -diff : diff;
+        if (diff >= step) {code |= 4; diff -= step;}
+        if (diff >= step >> 1) {code |= 2; diff -= step >> 1;}
+        if (diff >= step >> 2) {code |= 1;}
+        buzzer_adpcm_decode1(s, code);
+        dst[4 + i / 2] |= i % 2 ? code << 4 : code;
+    }
+}
+
+constexpr int adpcm_error() {
+    int16_t pcm[BUZZER_STREAM_FRAME] = {};
+    for (int i = 0; i < BUZZER_STREAM_FRAME; i++) {
+        pcm[i] = (int16_t)(16000 * buzzer_synth_sin(
+                2 * 3.14159265358979323846 * 500 * i / BUZZER_STREAM_RATE));
+    }
+    uint8_t frame[BUZZER_STREAM_ADPCM_BYTES] = {};
+    encode(pcm, frame);
+    int16_t out[BUZZER_STREAM_FRAME] = {};
+    buzzer_adpcm_decode(frame, out);
+    int ret = 0;
+    for (int i = 16; i < BUZZER_STREAM_FRAME; i++) {
+        auto e = out[i] - pcm[i];
+        ret = e > ret ? e : -e > ret ? -e : ret;
+    }
+    return ret;
+}
+// - a 500 Hz tone is decoded within 6% after the step adapts.
+static_assert(adpcm_error() < 1000);
+
+}  // namespace buzzer_stream_check
@@ -0,0 +1,101 @@
+/** @file buzzer_synth.cpp
+ *
+ * Home Buzzer - tone synthesizer
+ * ==================================
+ *
+ */
+#include <stdint.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "rom/ets_sys.h"
+
+#include "buzzer_synth.h"
+#include "homebuzzer.h"
+
+
+struct buzzer_synth_preset {
+    const char* name;
+    const buzzer_synth_note* notes;
+    int n_notes;
+};
+
+static const buzzer_synth_note ding_dong[] = {
+    {659, 659, 500, 2, 150},    // - E5
+    {523, 523, 800, 2, 250},    // - C5
+};
+static const buzzer_synth_note beep[] = {
+    {1000, 1000, 200, 5, 0},
+};
+static const buzzer_synth_note sweep_up[] = {
+    {400, 1600, 500, 10, 0},
+};
+static const buzzer_synth_note triple[] = {
+    {784, 784, 250, 2, 80},     // - G5
+    {988, 988, 250, 2, 80},     // - B5
+    {1175, 1175, 600, 2, 200},  // - D6
+};
+
+#define BUZZER_SYNTH_PRESET(notes) {#notes, notes, ARRAY_SIZE(notes)}
+/// presets by the sound number from `BUZZER_SYNTH_FIRST`.
+static const buzzer_synth_preset presets[] = {
+    BUZZER_SYNTH_PRESET(ding_dong),
+    BUZZER_SYNTH_PRESET(beep),
+    BUZZER_SYNTH_PRESET(sweep_up),
+    BUZZER_SYNTH_PRESET(triple),
+};
+#undef BUZZER_SYNTH_PRESET
+
+
+static const buzzer_synth_preset* buzzer_synth_preset_of(int sound) {
+    auto i = sound - BUZZER_SYNTH_FIRST;
+    if (i < 0 || i >= ARRAY_SIZE(presets)) {return nullptr;}
+    return &presets[i];
+}
+
+
+const char* buzzer_synth_name(int sound) {
+    auto preset = buzzer_synth_preset_of(sound);
+    return preset == nullptr ? nullptr : preset->name;
+}
+
+
+bool buzzer_synth_start(buzzer_synth* s, int sound) {
+    auto preset = buzzer_synth_preset_of(sound);
+    if (preset == nullptr) {return false;}
+    buzzer_synth_init(*s, preset->notes, preset->n_notes);
+    return true;
+}
+
+
+#if CONFIG_BUZZER_SYNTH_BENCH
+static const char tag[] = TAG_BUZZER;
+
+/** render all presets at boot, and report the cycles per sample
+ *  against the budget of the sample rate.
+ */
+extern "C" void buzzer_synth_bench(void) {
+    static int16_t buf[BUZZER_BYTES_FRAME / sizeof(int16_t)];
+    const uint32_t mhz = ets_get_cpu_frequency();
+    const int budget = mhz * 1000000 / BUZZER_SYNTH_RATE;  // - per sample
+
+    for (int i = 0; i < ARRAY_SIZE(presets); i++) {
+        buzzer_synth s;
+        buzzer_synth_start(&s, BUZZER_SYNTH_FIRST + i);
+        uint32_t cycles = 0;
+        int n_samples = 0;
+        for (;;) {
+            auto t = esp_cpu_get_cycle_count();
+            auto n = buzzer_synth_render(s, buf, ARRAY_SIZE(buf));
+            cycles += esp_cpu_get_cycle_count() - t;
+            if (n < 1) {break;}
+            n_samples += n;
+        }
+        ESP_LOGI(tag, "synth-bench: %s %d samples, %d.%02d cycles/sample "
+                 "(budget %d at %d Hz)", presets[i].name, n_samples,
+                 (int)(cycles / n_samples),
+                 (int)(cycles * 100ULL / n_samples % 100),
+                 budget, BUZZER_SYNTH_RATE);
+    }
+}
+#endif
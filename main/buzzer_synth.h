@@ -0,0 +1,228 @@
+/** @file buzzer_synth.h
+ *
+ * Home Buzzer - tone synthesizer
+ * ==========================================
+ *
+ * generates tones, sweeps and chimes without the TF card,
+ * played by the reserved sound numbers from `BUZZER_SYNTH_FIRST`.
+ *
+ * - DDS: 32-bit phase accumulator, 256 entries sine table
+ *   with the linear interpolation.
+ * - envelope: linear attack, exponential decay by the half-life (Q30),
+ *   and a short release at the end of each note against clicks.
+ * - all in fixed point, 16-bit mono samples at `BUZZER_SYNTH_RATE`.
+ */
+#pragma once
+#include <stdint.h>
+#include <array>
+
+#include "buzzer_dac.h"
+#include "homebuzzer.h"
+
+
+constexpr int BUZZER_SYNTH_RATE = BUZZER_DAC_RATE;  /// the DAC opened by it
+constexpr int BUZZER_SYNTH_TABLE_BITS = 8;
+constexpr int BUZZER_SYNTH_RELEASE_BITS = 5;  /// 32 samples, 2 msec
+
+static_assert(BUZZER_SYNTH_FIRST >= BUZZER_SOUNDS);
+
+/// a note of the presets.
+struct buzzer_synth_note {
+    uint16_t hz;            /// start frequency
+    uint16_t hz_end;        /// end frequency, same as `hz` for a tone
+    uint16_t msec;
+    uint16_t attack_msec;
+    uint16_t half_msec;     /// half-life of the decay, 0 for a flat tone
+};
+
+/// state of the oscillator, the renderer advances it block by block.
+struct buzzer_synth {
+    const buzzer_synth_note* note;  /// next note
+    int n_notes;        /// notes after `note`
+    int n;              /// samples of the current note
+    int i;              /// current sample in the note
+    uint32_t phase;
+    uint32_t inc;       /// phase increment per sample
+    int32_t inc_step;   /// change of `inc` per sample for the sweep
+    int32_t env;        /// Q30
+    int32_t attack;     /// Q30 per sample, while `env` is rising
+    int32_t decay;      /// Q30 multiplier per sample, 0 for no decay
+};
+
+
+constexpr double buzzer_synth_sin(double x) {
+    constexpr double pi = 3.14159265358979323846;
+    while (x >= 2 * pi) {x -= 2 * pi;}
+    while (x < 0) {x += 2 * pi;}
+    double sign = 1;
+    if (x > pi) {x -= pi; sign = -1;}
+    if (x > pi / 2) {x = pi - x;}
+    // - Taylor series to x^11, error < 1e-8 in [0, pi/2].
+    double x2 = x * x, term = x, sum = x;
+    for (int k = 2; k <= 11; k += 2) {
+        term *= -x2 / (k * (k + 1));
+        sum += term;
+    }
+    return sign * sum;
+}
+
+
+/// Q15 sine, with a guard entry for the interpolation.
+constexpr auto buzzer_synth_table = [] () {
+    constexpr int n = 1 << BUZZER_SYNTH_TABLE_BITS;
+    std::array<int16_t, n + 1> ret{};
+    for (int i = 0; i <= n; i++) {
+        auto v = buzzer_synth_sin(2 * 3.14159265358979323846 * i / n) * 32767;
+        ret[i] = (int16_t)(v < 0 ? v - 0.5 : v + 0.5);
+    }
+    return ret;
+}();
+
+
+constexpr void buzzer_synth_begin(buzzer_synth& s,
+                                  const buzzer_synth_note& note) {
+    auto inc = [] (uint32_t hz) {
+        return (uint32_t)(((uint64_t)hz << 32) / BUZZER_SYNTH_RATE);
+    };
+    s.n = note.msec * BUZZER_SYNTH_RATE / 1000;
+    s.i = 0;
+    s.inc = inc(note.hz);
+    s.inc_step = s.n > 0 ? (int32_t)(((int64_t)inc(note.hz_end) - s.inc) /
+                                     s.n) : 0;
+    auto n_attack = note.attack_msec * BUZZER_SYNTH_RATE / 1000;
+    s.env = n_attack > 0 ? 0 : 1 << 30;
+    s.attack = n_attack > 0 ? (1 << 30) / n_attack : 0;
+    // - 2^(-1/n) ~= 1 - ln(2)/n, ln(2) = 744261118 in Q30.
+    auto n_half = note.half_msec * BUZZER_SYNTH_RATE / 1000;
+    s.decay = n_half > 0 ? (1 << 30) - 744261118 / n_half : 0;
+}
+
+
+constexpr void buzzer_synth_init(buzzer_synth& s,
+                                 const buzzer_synth_note* notes, int n_notes) {
+    s = {notes, n_notes, 0, 0, 0, 0, 0, 0, 0, 0};
+}
+
+
+/** render the next `len` samples at most,
+ *  return the number of samples, 0 at the end of the notes.
+ */
+constexpr int buzzer_synth_render(buzzer_synth& s, int16_t* dst, int len) {
+    constexpr int shift = 32 - BUZZER_SYNTH_TABLE_BITS;
+    int n = 0;
+    while (n < len) {
+        if (s.i >= s.n) {
+            if (s.n_notes < 1) {break;}
+            buzzer_synth_begin(s, *s.note++);
+            s.n_notes--;
+            continue;
+        }
+        auto idx = s.phase >> shift;
+        int32_t frac = (s.phase >> (shift - 16)) & 0xFFFF;
+        int32_t a = buzzer_synth_table[idx];
+        int32_t b = buzzer_synth_table[idx + 1];
+        auto v = a + (((b - a) * frac) >> 16);
+
+        int32_t gain = s.env >> 15;
+        auto rest = s.n - s.i;
+        if (rest < (1 << BUZZER_SYNTH_RELEASE_BITS)) {
+            gain = (gain * rest) >> BUZZER_SYNTH_RELEASE_BITS;
+        }
+        dst[n++] = (int16_t)((v * gain) >> 15);
+
+        s.phase += s.inc;
+        s.inc += s.inc_step;
+        if (s.attack > 0) {
+            s.env += s.attack;
+            if (s.env >= (1 << 30)) {
+                s.env = 1 << 30;
+                s.attack = 0;
+            }
+        } else if (s.decay > 0) {
+            s.env = (int32_t)(((int64_t)s.env * s.decay) >> 30);
+        }
+        s.i++;
+    }
+    return n;
+}
+
+
+/// name of the preset, nullptr if `sound` is not a synthesized one.
+extern const char* buzzer_synth_name(int sound);
+
+/// start the preset, false if `sound` is not a synthesized one.
+extern bool buzzer_synth_start(buzzer_synth* s, int sound);
+
+
+namespace buzzer_synth_check {
+
+/// power of the bin `k` in `n` samples (Goertzel).
+constexpr double power(const int16_t* x, int n, int k) {
+    constexpr double pi = 3.14159265358979323846;
+    auto c = 2 * buzzer_synth_sin(2 * pi * k / n + pi / 2);
+    double s1 = 0, s2 = 0;
+    for (int i = 0; i < n; i++) {
+        auto s0 = x[i] + c * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    return s1 * s1 + s2 * s2 - c * s1 * s2;
+}
+
+constexpr int N = 256;
+constexpr int K = N * 1000 / BUZZER_SYNTH_RATE;   /// 1000 Hz
+static_assert(K * BUZZER_SYNTH_RATE == N * 1000);
+constexpr buzzer_synth_note tone[] = {{1000, 1000, 100, 5, 0}};
+constexpr buzzer_synth_note sweep[] = {{500, 2000, 100, 0, 0}};
+constexpr buzzer_synth_note chime[] = {{1000, 1000, 100, 0, 10}};
+
+/// render 2 * N samples, the second half is in the steady state.
+constexpr auto render(const buzzer_synth_note* notes) {
+    std::array<int16_t, 2 * N> buf{};
+    buzzer_synth s{};
+    buzzer_synth_init(s, notes, 1);
+    buzzer_synth_render(s, buf.data(), 2 * N);
+    return buf;
+}
+
+constexpr auto tone_buf = render(tone);
+constexpr double tone_at(int k) {return power(tone_buf.data() + N, N, k);}
+// - the fundamental dominates the harmonics by 50 dB, the neighbours by 40 dB.
+static_assert(tone_at(K) > 1e5 * tone_at(2 * K));
+static_assert(tone_at(K) > 1e5 * tone_at(3 * K));
+static_assert(tone_at(K) > 1e4 * tone_at(K - 1));
+static_assert(tone_at(K) > 1e4 * tone_at(K + 1));
+
+constexpr int crossings(const int16_t* x, int n) {
+    int ret = 0;
+    for (int i = 1; i < n; i++) {
+        ret += (x[i - 1] < 0) != (x[i] < 0);
+    }
+    return ret;
+}
+constexpr auto sweep_buf = [] () {
+    std::array<int16_t, 100 * BUZZER_SYNTH_RATE / 1000> buf{};
+    buzzer_synth s{};
+    buzzer_synth_init(s, sweep, 1);
+    buzzer_synth_render(s, buf.data(), buf.size());
+    return buf;
+}();
+// - 500 Hz at the beginning and 2000 Hz at the end of the sweep.
+static_assert(crossings(sweep_buf.data(), N) < 24);
+static_assert(crossings(sweep_buf.data() + sweep_buf.size() - N - 32, N) > 50);
+
+constexpr int peak(const int16_t* x, int n) {
+    int ret = 0;
+    for (int i = 0; i < n; i++) {
+        ret = x[i] > ret ? x[i] : ret;
+    }
+    return ret;
+}
+constexpr auto chime_buf = render(chime);
+// - half amplitude after the half-life (10 msec).
+constexpr int half = 10 * BUZZER_SYNTH_RATE / 1000;
+static_assert(peak(chime_buf.data(), 32) > 32000);
+static_assert(peak(chime_buf.data() + half, 32) > 14000);
+static_assert(peak(chime_buf.data() + half, 32) < 18000);
+
+}  // namespace buzzer_synth_check
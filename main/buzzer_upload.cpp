@@ -0,0 +1,291 @@
+/** @file buzzer_upload.cpp
+ *
+ * Home Buzzer - sound bank upload
+ * ==================================
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "host/ble_hs.h"
+
+#include "buzzer_bank.h"
+#include "buzzer_stream.h"
+#include "buzzer_upload.h"
+#include "homebuzzer.h"
+
+
+#if CONFIG_BUZZER_UPLOAD
+#define BUZZER_UPLOAD_TASKTAG "BUZZER-UPLOAD"
+
+/// the TF card as the storage of `buzzer_bank.h`.
+struct buzzer_upload_fs {
+    FILE* fp;           /// temporary file of the open one
+    int64_t t_write;    /// time in the storage writes
+
+    bool take() {return buzzer_card_take();}
+    void give(bool refresh) {buzzer_card_give(refresh);}
+
+    static void path(char* dst, size_t len, buzzer_bank_name kind, int i,
+                     const char* name) {
+        switch (kind) {
+        case buzzer_bank_name::TMP:
+            snprintf(dst, len, "%s/UPLOAD%d.TMP", BUZZER_MOUNT_POINT, i);
+            return;
+        case buzzer_bank_name::BAK:
+            snprintf(dst, len, "%s/UPLOAD%d.BAK", BUZZER_MOUNT_POINT, i);
+            return;
+        case buzzer_bank_name::DST:
+            snprintf(dst, len, "%s/%s", BUZZER_MOUNT_POINT, name);
+            return;
+        }
+    }
+
+    bool create(int i) {
+        char tmp[30];
+        path(tmp, sizeof(tmp), buzzer_bank_name::TMP, i, nullptr);
+        fp = fopen(tmp, "w");
+        return fp != nullptr;
+    }
+
+    bool write(const uint8_t* src, int len) {
+        auto t = esp_timer_get_time();
+        auto n = fwrite(src, 1, len, fp);
+        t_write += esp_timer_get_time() - t;
+        return n == (size_t)len;
+    }
+
+    void close() {
+        if (fp == nullptr) {return;}
+        fclose(fp);
+        fp = nullptr;
+    }
+
+    bool move(buzzer_bank_name from, buzzer_bank_name to, int i,
+              const char* name) {
+        char src[30], dst[30];
+        path(src, sizeof(src), from, i, name);
+        path(dst, sizeof(dst), to, i, name);
+        return rename(src, dst) == 0;
+    }
+
+    void remove(buzzer_bank_name kind, int i, const char* name) {
+        char dst[30];
+        path(dst, sizeof(dst), kind, i, name);
+        ::remove(dst);
+    }
+
+    uint32_t crc(uint32_t crc, const uint8_t* src, int len) {
+        return esp_rom_crc32_le(crc, src, len);
+    }
+};
+
+static const char tag[] = TAG_BUZZER;
+
+static buzzer_upload_fs card = {nullptr, 0};
+static buzzer_bank<buzzer_upload_fs> bank;
+static int64_t t_begin = 0;         /// time of the first begin of the bank
+
+
+void buzzer_upload_abort(void) {
+    auto n = buzzer_bank_abort(bank);
+    if (n < 1) {return;}
+    ESP_LOGE(tag, "buzzer_upload: %d files discarded", n);
+}
+
+
+/// log the answered end and commit, with the speed of the bank.
+static void buzzer_upload_log(uint8_t op, buzzer_upload_status status,
+                              int n_files) {
+    auto usec = esp_timer_get_time() - t_begin;
+    int kbps = usec > 0 ? (int)(bank.n_bytes * 1000LL / usec) : 0;
+    if (op == BUZZER_UPLOAD_COMMIT && status != BUZZER_UPLOAD_E_FORMAT) {
+        ESP_LOGI(tag, "buzzer_upload: %s %d files, %d bytes in %d msec, "
+                 "%d kB/s", status == BUZZER_UPLOAD_OK ? "committed"
+                                                       : "rolled back",
+                 n_files, (int)bank.n_bytes, (int)(usec / 1000), kbps);
+    } else if (op == BUZZER_UPLOAD_END && status == BUZZER_UPLOAD_OK) {
+        auto& file = bank.files[bank.n_files - 1];
+        ESP_LOGI(tag, "buzzer_upload: %s %d bytes, bank %d kB/s "
+                 "(write %d kB/s)", file.name, (int)file.size, kbps,
+                 card.t_write > 0 ? (int)(bank.n_bytes * 1000LL / card.t_write)
+                                  : 0);
+    } else if (op == BUZZER_UPLOAD_END && status == BUZZER_UPLOAD_E_VERIFY) {
+        // - the broken one was removed from the bank.
+        auto& file = bank.files[bank.n_files];
+        ESP_LOGE(tag, "buzzer_upload: %s broken, %d/%d bytes",
+                 file.name, (int)file.received, (int)file.size);
+    }
+}
+
+
+buzzer_upload_status buzzer_upload_feed(const uint8_t* src, int len) {
+    if (len < 1) {return BUZZER_UPLOAD_E_FORMAT;}
+    #if CONFIG_BUZZER_STREAM
+    if (src[0] == BUZZER_UPLOAD_STREAM) {
+        buzzer_stream_put(src, len);
+        return BUZZER_UPLOAD_NO_ACK;
+    }
+    #endif
+    const int n_files = bank.n_files;
+    auto status = buzzer_bank_feed(bank, src, len);
+    switch (src[0]) {
+    case BUZZER_UPLOAD_BEGIN:
+        if (status == BUZZER_UPLOAD_NO_ACK && bank.n_files == 1) {
+            t_begin = esp_timer_get_time();
+            card.t_write = 0;
+        }
+        break;
+    case BUZZER_UPLOAD_END:
+    case BUZZER_UPLOAD_COMMIT:
+        buzzer_upload_log(src[0], status, n_files);
+        break;
+    }
+    return status;
+}
+
+
+// - L2CAP transport.
+//   the host task passes the SDUs to the writer task by the queue,
+//   and gives a new buffer to the channel for the next credits.
+//   if `BUZZER_UPLOAD_BUFS` SDUs are waiting, the credits are stopped
+//   until the writer frees one (`stalled`).
+
+// - an SDU of the MTU takes 2 blocks with the headers.
+#define BUZZER_UPLOAD_BLOCKS ((BUZZER_UPLOAD_BUFS + 1) * 2)
+static os_membuf_t sdu_mem[OS_MEMPOOL_SIZE(BUZZER_UPLOAD_BLOCKS,
+                                           CONFIG_BUZZER_UPLOAD_MTU)];
+static struct os_mempool sdu_mempool;
+static struct os_mbuf_pool sdu_pool;
+static std::atomic<ble_l2cap_chan*> channel(nullptr);
+static std::atomic<ble_l2cap_chan*> stalled(nullptr);
+static std::atomic<int> n_queued(0);
+
+static QueueHandle_t queue;   /// SDUs to write, nullptr for the disconnect
+static StaticQueue_t queue_buf;
+static uint8_t queue_storage[(BUZZER_UPLOAD_BUFS + 1) * sizeof(os_mbuf*)];
+static StaticTask_t task_buf;
+static StackType_t task_stack[BUZZER_UPLOAD_STACK_SIZE];
+static uint8_t sdu_buf[CONFIG_BUZZER_UPLOAD_MTU];
+
+
+
+static int buzzer_upload_rx_ready(ble_l2cap_chan* chan) {
+    if (n_queued.load() >= BUZZER_UPLOAD_BUFS) {
+        stalled.store(chan);
+        return 0;
+    }
+    auto sdu = os_mbuf_get_pkthdr(&sdu_pool, 0);
+    if (sdu == nullptr) {return BLE_HS_ENOMEM;}
+    return ble_l2cap_recv_ready(chan, sdu);
+}
+
+
+static void buzzer_upload_ack(uint8_t op, buzzer_upload_status status) {
+    auto chan = channel.load();
+    if (chan == nullptr) {return;}
+    const uint8_t ack[2] = {op, status};
+    auto om = ble_hs_mbuf_from_flat(ack, sizeof(ack));
+    if (om == nullptr) {return;}
+    auto rc = ble_l2cap_send(chan, om);
+    if (rc != 0 && rc != BLE_HS_ESTALLED) {
+        os_mbuf_free_chain(om);
+    }
+}
+
+
+static int buzzer_upload_l2cap_event(struct ble_l2cap_event* event,
+                                     void* arg) {
+    os_mbuf* none = nullptr;
+    ble_gap_conn_desc desc;
+    switch (event->type) {
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        if (event->connect.status != 0) {
+            ESP_LOGE(tag, "buzzer_upload: connect failed %d",
+                     event->connect.status);
+            return 0;
+        }
+        ESP_LOGI(tag, "buzzer_upload: connected, conn_handle=%d",
+                 event->connect.conn_handle);
+        channel.store(event->connect.chan);
+        return 0;
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        ESP_LOGI(tag, "buzzer_upload: disconnected");
+        channel.store(nullptr);
+        stalled.store(nullptr);
+        xQueueSend(queue, &none, portMAX_DELAY);
+        return 0;
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        // - the sounds and the stream only over an encrypted link,
+        //   the hub pairs and opens the channel again.
+        if (ble_gap_conn_find(event->accept.conn_handle, &desc) != 0 ||
+                !desc.sec_state.encrypted) {
+            ESP_LOGE(tag, "buzzer_upload: rejected, not encrypted");
+            return BLE_HS_EENCRYPT;
+        }
+        return buzzer_upload_rx_ready(event->accept.chan);
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        n_queued++;
+        xQueueSend(queue, &event->receive.sdu_rx, 0);
+        buzzer_upload_rx_ready(event->receive.chan);
+        return 0;
+    }
+    return 0;
+}
+
+
+static void buzzer_upload_task(void* params) {
+    buzzer_report_task();
+    for (;;) {
+        os_mbuf* sdu;
+        if (!xQueueReceive(queue, &sdu, portMAX_DELAY)) {continue;}
+        if (sdu == nullptr) {
+            buzzer_upload_abort();
+            buzzer_report_memory("upload");
+            continue;
+        }
+        auto len = std::min<int>(OS_MBUF_PKTLEN(sdu), sizeof(sdu_buf));
+        os_mbuf_copydata(sdu, 0, len, sdu_buf);
+        os_mbuf_free_chain(sdu);
+        n_queued--;
+        if (auto chan = stalled.exchange(nullptr); chan != nullptr) {
+            buzzer_upload_rx_ready(chan);
+        }
+
+        auto status = buzzer_upload_feed(sdu_buf, len);
+        if (status != BUZZER_UPLOAD_NO_ACK) {
+            buzzer_upload_ack(sdu_buf[0], status);
+        }
+    }
+}
+
+
+extern "C" void buzzer_upload_init(void) {
+    buzzer_bank_init(bank, &card);
+    os_mempool_init(&sdu_mempool, BUZZER_UPLOAD_BLOCKS,
+                    CONFIG_BUZZER_UPLOAD_MTU, sdu_mem, "buzzer_upload");
+    os_mbuf_pool_init(&sdu_pool, &sdu_mempool, CONFIG_BUZZER_UPLOAD_MTU,
+                      BUZZER_UPLOAD_BLOCKS);
+    queue = xQueueCreateStatic(BUZZER_UPLOAD_BUFS + 1, sizeof(os_mbuf*),
+                               queue_storage, &queue_buf);
+    xTaskCreateStaticPinnedToCore(buzzer_upload_task, BUZZER_UPLOAD_TASKTAG,
+                                  BUZZER_UPLOAD_STACK_SIZE, nullptr, 3,
+                                  task_stack, &task_buf, tskNO_AFFINITY);
+
+    auto rc = ble_l2cap_create_server(CONFIG_BUZZER_UPLOAD_PSM,
+                                      CONFIG_BUZZER_UPLOAD_MTU,
+                                      buzzer_upload_l2cap_event, nullptr);
+    if (rc != 0) {
+        ESP_LOGE(tag, "buzzer_upload: can't create the server %d", rc);
+    }
+}
+#endif
@@ -0,0 +1,62 @@
+/** @file buzzer_upload.h
+ *
+ * Home Buzzer - sound bank upload
+ * ==========================================
+ *
+ * the hub uploads sounds to the TF card over an L2CAP
+ * connection-oriented channel (PSM `BUZZER_UPLOAD_PSM`).
+ *
+ * each SDU starts with the operation:
+ *
+ * begin   | 0: 0x01 | 1-4: size | 5-: file name (8.3, NUL terminated) |
+ * data    | 0: 0x02 | 1-: data |
+ * end     | 0: 0x03 | 1-4: CRC32 of the file |
+ * commit  | 0: 0x04 |
+ * stream  | 0: 0x05 | see `buzzer_stream.h` |
+ *
+ * - begin/data/end upload a file to a temporary file, several files
+ *   (a sound bank) can be uploaded before the commit.
+ * - commit renames all the uploaded files, and refreshes the catalog
+ *   once before the card is given back, so the playback sees the old
+ *   bank or the new one as a whole.
+ *   the old files are restored if a rename fails.
+ * - the states are in `buzzer_bank.h`.
+ * - the channel is accepted only over an encrypted link.
+ * - end and commit are answered by 2 bytes: the operation and the status
+ *   (`buzzer_upload_status`).
+ * - files are written while they are received, the window of the L2CAP
+ *   credits is `BUZZER_UPLOAD_BUFS` SDUs.
+ * - a disconnect before the commit discards the uploaded files.
+ */
+#pragma once
+#include <stdint.h>
+
+
+#define BUZZER_UPLOAD_BUFS 4         /// SDUs in flight
+#define BUZZER_UPLOAD_STACK_SIZE 4096
+
+enum buzzer_upload_op : uint8_t {
+    BUZZER_UPLOAD_BEGIN = 0x01,
+    BUZZER_UPLOAD_DATA = 0x02,
+    BUZZER_UPLOAD_END = 0x03,
+    BUZZER_UPLOAD_COMMIT = 0x04,
+    BUZZER_UPLOAD_STREAM = 0x05,    /// a frame of the live stream
+};
+
+enum buzzer_upload_status : uint8_t {
+    BUZZER_UPLOAD_OK = 0,
+    BUZZER_UPLOAD_E_FORMAT = 1,     /// malformed or unexpected operation
+    BUZZER_UPLOAD_E_CARD = 2,       /// no card or write failed
+    BUZZER_UPLOAD_E_VERIFY = 3,     /// size or CRC mismatch
+    BUZZER_UPLOAD_E_FULL = 4,       /// too many files in the bank
+    BUZZER_UPLOAD_NO_ACK = 0xFF,    /// no answer for this operation
+};
+
+
+/** process an SDU, independent of the transport.
+ *  return the status to answer, or `BUZZER_UPLOAD_NO_ACK`.
+ */
+extern buzzer_upload_status buzzer_upload_feed(const uint8_t* src, int len);
+
+/// discard the files not committed yet.
+extern void buzzer_upload_abort(void);
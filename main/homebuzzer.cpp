@@ -4,41 +4,112 @@
  * ==================================
  *
  */
-#include <dirent.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <tuple>
 
-#include "driver/dac.h"
+#include "driver/dac_continuous.h"
 #include "driver/i2s_std.h"
 #include "driver/sdmmc_host.h"
+#include "diskio_sdmmc.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_vfs_fat.h"
+#include "ff.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "host/ble_hs.h"
 // #include "host/util/util.h"
-#include "rom/ets_sys.h"
 #include "sdmmc_cmd.h"
 // #include "services/gap/ble_svc_gap.h"
 
 
 #include "blecent.h"
+#include "buzzer_adv.h"
+#include "buzzer_clip.h"
+#include "buzzer_clock.h"
+#include "buzzer_dac.h"
+#include "buzzer_eq.h"
+#include "buzzer_filter.h"
+#include "buzzer_log.h"
+#include "buzzer_stream.h"
+#include "buzzer_synth.h"
 #include "homebuzzer.h"
 
 
 #define BUZZER_TASKTAG "BUZZER"
+#define BUZZER_CARD_TASKTAG "BUZZER-CARD"
 
-const dac_channel_t buzzer_dac_ch =
-#if CONFIG_BUZZER_DAC_CH == 2
-    DAC_CHANNEL_2;  /// GPIO26
+#if CONFIG_BUZZER_DAC_STEREO
+static const dac_channel_mask_t buzzer_dac_mask = DAC_CHANNEL_MASK_ALL;
+#elif CONFIG_BUZZER_DAC_CH2
+static const dac_channel_mask_t buzzer_dac_mask = DAC_CHANNEL_MASK_CH1;
 #else
-    DAC_CHANNEL_1;  /// GPIO25 (M5 Stack)
+static const dac_channel_mask_t buzzer_dac_mask = DAC_CHANNEL_MASK_CH0;
 #endif
 
 static QueueHandle_t queue;
-static TaskHandle_t task_handle;
+static StaticQueue_t queue_buf;
+static uint8_t queue_storage[sizeof(buzzer_req)];
+static SemaphoreHandle_t queue_mutex;  /// for the preemption of `queue`
+static StaticSemaphore_t queue_mutex_buf;
+/// the request in `queue` was replaced, stop the playing sound.
+static std::atomic<bool> preempted(false);
+static StaticTask_t task_buf;
+static StackType_t task_stack[BUZZER_STACK_SIZE];
+static StaticTask_t card_task_buf;
+static StackType_t card_task_stack[BUZZER_STACK_SIZE];
+/// tasks of the stack reports, added by `buzzer_report_task()`.
+static TaskHandle_t report_tasks[BUZZER_REPORT_TASKS];
+static std::atomic<int> n_report_tasks(0);
+
+/// nullptr if no card, only the card task changes it.
+static sdmmc_card_t* tf_card = nullptr;
+/// held while using the card: the playback, the upload and the card task
+/// (the status, the mount and the scan).
+static SemaphoreHandle_t card_mutex;
+static StaticSemaphore_t card_mutex_buf;
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t pm_lock;  /// keep awake while playing
+#endif
+/// the audio buffer of the buzzer task, no allocation while playing.
+alignas(4) static int8_t audio_buf[BUZZER_BYTES_FRAME];
+static dac_continuous_handle_t dac_handle;  /// while playing
+alignas(4) static uint8_t dac_block[BUZZER_DAC_BLOCK];  /// packed DAC bytes
+#if !CONFIG_BUZZER_EQ_NONE
+/// decoded samples to filter, by channel.
+static int16_t eq_block[2][BUZZER_EQ_BLOCK];
+static_assert(BUZZER_EQ_BLOCK * 2 <= BUZZER_DAC_BLOCK);
+#endif
+
+/// a sound file in the catalog.
+struct buzzer_clip {
+    char* name;
+    uint32_t sector;    /// first sector if contiguous on the card, or 0
+    uint32_t n_bytes;
+    uint32_t stamp;     /// FAT date and time of the file
+};
+
+/// catalog of the sounds, the refresh swaps it as a whole.
+struct buzzer_catalog {
+    uint32_t serial;    /// serial number of the card
+    buzzer_clip clips[BUZZER_SOUNDS];
+    char arena[BUZZER_CATALOG_ARENA];  /// for the filenames
+};
+
+/// source of the playback: raw sectors, or stdio if `fp` is set.
+struct buzzer_src {
+    FILE* fp;
+    uint32_t sector;
+    uint32_t remain;
+};
 
 static const int buzzer_bus_width =
     #if defined(CONFIG_BUZZER_MMC_BUS_WIDTH_4)
@@ -46,27 +117,86 @@ static const int buzzer_bus_width =
     #else
     1;
     #endif
-static const char mount_point[] = "/sdcard";
+static const char mount_point[] = BUZZER_MOUNT_POINT;
 static const char tag[] = TAG_BUZZER;
-static char* sounds[10] = {
-    (char*)nullptr, (char*)nullptr, (char*)nullptr, (char*)nullptr,
-    (char*)nullptr, (char*)nullptr, (char*)nullptr, (char*)nullptr,
-    (char*)nullptr, (char*)nullptr,
-};
+/// the refresh writes the one not `catalog_last`, and swaps `catalog`.
+static buzzer_catalog catalogs[2];
+static const buzzer_catalog catalog_none = {};  /// without the card
+static std::atomic<const buzzer_catalog*> catalog(&catalog_none);
+static const buzzer_catalog* catalog_last = &catalogs[0];  /// last scanned
+
+/// counters of the advertisement ingest path.
+static struct {
+    uint32_t seen;
+    uint32_t accepted;
+    uint32_t rate_limited;
+    uint32_t deduplicated;
+} adv_stats = {0, 0, 0, 0};
+
+/// stages of the advertisement filter, see `buzzer_filter.h`.
+static constexpr uint8_t filter_skip =
+    const_strcmp(CONFIG_BUZZER_PEER_ADDR, "ADDR_ANY") == 0 ?
+    1 << BUZZER_FILTER_ADDR : 0;
+#if CONFIG_BUZZER_ADV_REORDER
+static constexpr bool filter_reorder = true;
+#else
+static constexpr bool filter_reorder = false;
+#endif
+/// the order, the stats, the rate buckets and the history,
+/// `buzzer_adv_reset()` clears them.
+static buzzer_filter filter;
+static struct {
+    int64_t last;
+    int64_t sum;
+    int64_t max;
+    int n;
+} latency_stats = {0, 0, 0, 0};
+
+
+static const char* const buzzer_tf_name =
+    #if CONFIG_BUZZER_TF_SDMMC
+    "sdmmc";
+    #else
+    "sdspi";
+    #endif
 
 
-static std::tuple<esp_vfs_fat_sdmmc_mount_config_t,
-                  int, sdmmc_host_t,
-                  sdspi_device_config_t> buzzer_tf_init() {
-    esp_vfs_fat_sdmmc_mount_config_t ret1 = {
+static esp_vfs_fat_sdmmc_mount_config_t buzzer_tf_mount_config() {
+    esp_vfs_fat_sdmmc_mount_config_t ret = {
         .format_if_mount_failed = false,
         .max_files = 5,
         .allocation_unit_size = 16 * 1024,
         .disk_status_check_enable = false,
     };
+    return ret;
+}
+
+
+#if CONFIG_BUZZER_TF_SDMMC
+static std::tuple<esp_vfs_fat_sdmmc_mount_config_t,
+                  int, sdmmc_host_t,
+                  sdmmc_slot_config_t> buzzer_tf_init() {
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    #if CONFIG_BUZZER_MMC_HIGHSPEED
+    host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+    #endif
 
+    // - ESP32 uses the fixed pins of the slot 1.
+    sdmmc_slot_config_t ret2 = SDMMC_SLOT_CONFIG_DEFAULT();
+    ret2.width = buzzer_bus_width;
+    ret2.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    return {buzzer_tf_mount_config(), ESP_OK, host, ret2};
+}
+#else
+static std::tuple<esp_vfs_fat_sdmmc_mount_config_t,
+                  int, sdmmc_host_t,
+                  sdspi_device_config_t> buzzer_tf_init() {
     static bool f_init = true;
     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    #if CONFIG_BUZZER_MMC_HIGHSPEED
+    host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+    #endif
     spi_bus_config_t bus_cfg = {
         .mosi_io_num = CONFIG_BUZZER_MMC_MOSI,
         .miso_io_num = CONFIG_BUZZER_MMC_MISO,
@@ -91,7 +221,24 @@ static std::tuple<esp_vfs_fat_sdmmc_mount_config_t,
     ret2.gpio_cs = (gpio_num_t)CONFIG_BUZZER_MMC_CS;
     ret2.host_id = hostid;
 
-    return {ret1, rc, host, ret2};
+    return {buzzer_tf_mount_config(), rc, host, ret2};
+}
+#endif
+
+
+static esp_err_t buzzer_tf_mount(
+        const sdmmc_host_t& host, const sdspi_device_config_t& slot,
+        const esp_vfs_fat_sdmmc_mount_config_t& cfg, sdmmc_card_t** card
+) {
+    return esp_vfs_fat_sdspi_mount(mount_point, &host, &slot, &cfg, card);
+}
+
+
+static esp_err_t buzzer_tf_mount(
+        const sdmmc_host_t& host, const sdmmc_slot_config_t& slot,
+        const esp_vfs_fat_sdmmc_mount_config_t& cfg, sdmmc_card_t** card
+) {
+    return esp_vfs_fat_sdmmc_mount(mount_point, &host, &slot, &cfg, card);
 }
 
 
@@ -123,102 +270,227 @@ static i2s_chan_handle_t buzzer_sound_init(void) {
 }
 
 
-static std::tuple<int, bool, int> buzzer_sound_read_format(FILE* fp) {
-    uint8_t tmp[8];
-    fread(tmp, 1, 4, fp);  // - `RIFF`
-    fread(tmp, 1, 4, fp);  // - file size
-    fread(tmp, 1, 4, fp);  // - `WAVE`
-    fread(tmp, 1, 4, fp);  // - `fmt\0`
-    fread(tmp, 1, 4, fp);  // - 16 for header length.
-    fread(tmp, 1, 2, fp);  // - 1:PCM
-    fread(tmp, 1, 2, fp);  // - channel
-    auto channels = *(uint16_t*)tmp;
-    fread(tmp, 1, 4, fp);  // - sample rate (sample/sec)
-    auto rate = *(uint32_t*)tmp;
-    fread(tmp, 1, 4, fp);  // - sample rate (bytes/sec)
-    fread(tmp, 1, 2, fp);  // - block alignment
-    fread(tmp, 1, 2, fp);  // - bits per sample
-    auto sample = *(uint16_t*)tmp;
-    fread(tmp, 1, 4, fp);  // - `data` : beginning of data section.
-    fread(tmp, 1, 4, fp);  // - size of data section
-
-    // auto tick = (1000000 + (rate >> 1)) / rate;
-    auto tick = 1000000 / rate;
-    #if 0
-    auto tick = rate == 44100 ? 23:  /// - 44100Hz -> 22.6[usec]
-                rate == 48000 ? 21:  /// - 48000Hz -> 20.8[usec]
-    #endif
+static std::tuple<int, bool, int> buzzer_sound_read_format(
+        const int8_t* src
+) {
+    auto u16 = [src] (int ofs) {
+        uint16_t v; memcpy(&v, &src[ofs], sizeof(v)); return v;
+    };
+    auto u32 = [src] (int ofs) {
+        uint32_t v; memcpy(&v, &src[ofs], sizeof(v)); return v;
+    };
+    // - 0: `RIFF`, 4: file size, 8: `WAVE`, 12: `fmt\0`
+    // - 16: 16 for header length, 20: 1:PCM
+    auto channels = u16(22);  // - channel
+    auto rate = u32(24);      // - sample rate (sample/sec)
+    // - 28: sample rate (bytes/sec), 32: block alignment
+    auto sample = u16(34);    // - bits per sample
+    // - 36: `data` : beginning of data section.
+    // - 40: size of data section
+    rate = rate < 1 ? 8000: rate;
+
     auto streao = channels != 1;
-    return {sample, streao, tick};
+    return {sample, streao, (int)rate};
+}
+
+
+/** start the DMA output of the DAC at `rate` samples/sec per channel,
+ *  the stereo output alternates the channels.
+ */
+static bool buzzer_dac_open(int rate) {
+    dac_continuous_config_t cfg = {
+        .chan_mask = buzzer_dac_mask,
+        .desc_num = BUZZER_DAC_DESCS,
+        .buf_size = BUZZER_DAC_BUF,
+        .freq_hz = (uint32_t)rate,
+        .offset = 0,
+        .clk_src = DAC_DIGI_CLK_SRC_APLL,  // - down to 8 kHz.
+        .chan_mode = buzzer_dac_stereo ? DAC_CHANNEL_MODE_ALTER
+                                       : DAC_CHANNEL_MODE_SIMUL,
+    };
+    auto rc = dac_continuous_new_channels(&cfg, &dac_handle);
+    if (rc != ESP_OK) {
+        ESP_LOGE(tag, "buzzer_dac: %d Hz failed %s", rate, esp_err_to_name(rc));
+        dac_handle = nullptr;
+        return false;
+    }
+    ESP_ERROR_CHECK(dac_continuous_enable(dac_handle));
+    return true;
+}
+
+
+/// send the DAC bytes, blocks while the DMA buffers are full.
+static void buzzer_dac_write(const uint8_t* buf, int n) {
+    size_t n_loaded = 0;
+    auto rc = dac_continuous_write(dac_handle, (uint8_t*)buf, n, &n_loaded, -1);
+    if (rc != ESP_OK) {
+        ESP_LOGE(tag, "buzzer_dac: write failed %s", esp_err_to_name(rc));
+    }
 }
 
 
-static inline std::tuple<int, int> buzzer_sound_read1(
+/** play out the DMA buffers by the silence, then stop the output.
+ */
+static void buzzer_dac_close() {
+    if (dac_handle == nullptr) {return;}
+    memset(dac_block, buzzer_dac_level(0, 0), sizeof(dac_block));
+    for (int n = 0; n < BUZZER_DAC_DESCS * BUZZER_DAC_BUF;
+            n += sizeof(dac_block)) {
+        buzzer_dac_write(dac_block, sizeof(dac_block));
+    }
+    dac_continuous_disable(dac_handle);
+    dac_continuous_del_channels(dac_handle);
+    dac_handle = nullptr;
+}
+
+
+/// read a frame as 16-bit left and right, mono sounds return the same.
+static inline std::tuple<int, int, int> buzzer_sound_read16(
         const int8_t* src, int m, int n_bits, bool streao
 ) {
     if (streao) {
         if (n_bits == 16) {
             auto l = *(int16_t*)&src[m];
             auto r = *(int16_t*)&src[m + 2];
-            auto v = ((int)l + (int)r) / 512;
-            return {4, v};
+            return {4, l, r};
         } else {
-            auto l = src[m];
-            auto r = src[m + 1];
-            auto v = ((int)l + (int)r) / 2;
-            return {2, v};
+            return {2, (int)src[m] * 256, (int)src[m + 1] * 256};
         }
     } else {
         if (n_bits == 16) {
-            auto l = *(int16_t*)&src[m];
-            auto v = ((int)l) / 256;
-            return {2, v};
+            auto v = (int)*(int16_t*)&src[m];
+            return {2, v, v};
         } else {
-            auto v = (int)src[m];
-            return {1, v};
+            return {1, (int)src[m] * 256, (int)src[m] * 256};
         }
     }
 }
 
 
 static void buzzer_sound_loop(const int8_t* src, int len,
-                              int n_bits, bool streao, int tick
+                              int n_bits, bool streao, int volume
 ) {
-    auto i = 0;
     auto n = 0;
     while (n < len) {
-        auto [idx, val] = buzzer_sound_read1(src, n, n_bits, streao);
-        val = ((val % 128) / 3) + 64;
-        n += idx;
-        dac_output_voltage(buzzer_dac_ch, val);
-        ets_delay_us(tick);
-        i++;
+        auto [n_src, m] = buzzer_dac_pack(src + n, len - n, n_bits, streao,
+                                          volume, buzzer_dac_stereo,
+                                          dac_block, sizeof(dac_block));
+        n += n_src;
+        buzzer_dac_write(dac_block, m);
     }
-    #if 0
-    ESP_LOGI(tag, "buzzer_sound_loop: %d,%d,%d-%d,%d",
-             n_bits, streao, tick, len, i);
-    #endif
 }
 
 
-static bool buzzer_sound(FILE* fp) {
-    if (fp == NULL) {
-        ESP_LOGE(tag, "Failed to open file for reading");
+#if !CONFIG_BUZZER_EQ_NONE
+/** decode to 16-bit blocks by channel, filter and output them.
+ *  stereo sounds are mixed down before the filter for the mono output.
+ */
+static void buzzer_sound_eq(const int8_t* src, int len,
+                            int n_bits, bool streao, int volume,
+                            const buzzer_eq_coefs& coefs,
+                            buzzer_biquad_state (*states)[BUZZER_EQ_BANDS]
+) {
+    const int n_chs = buzzer_dac_stereo && streao ? 2 : 1;
+    auto n = 0;
+    while (n < len) {
+        auto m = 0;
+        for (; m < BUZZER_EQ_BLOCK && n < len; m++) {
+            auto [idx, l, r] = buzzer_sound_read16(src, n, n_bits, streao);
+            if (n_chs == 2) {
+                eq_block[0][m] = l;
+                eq_block[1][m] = r;
+            } else {
+                eq_block[0][m] = (l + r) / 2;
+            }
+            n += idx;
+        }
+        for (int ch = 0; ch < n_chs; ch++) {
+            buzzer_eq_process(coefs, states[ch], eq_block[ch], m);
+        }
+        auto n_dac = buzzer_dac_pack16(eq_block[0], eq_block[n_chs - 1], m,
+                                       volume, buzzer_dac_stereo, dac_block);
+        buzzer_dac_write(dac_block, n_dac);
+    }
+}
+#endif
+
+
+static int buzzer_src_read(buzzer_src* src, int8_t* buf) {
+    if (src->fp != nullptr) {
+        return fread(buf, sizeof(int8_t), BUZZER_BYTES_FRAME, src->fp);
+    }
+    if (src->remain < 1) {return 0;}
+
+    auto [n, n_sectors] = buzzer_clip_next(src->remain, BUZZER_BYTES_FRAME,
+                                           tf_card->csd.sector_size);
+    auto rc = sdmmc_read_sectors(tf_card, buf, src->sector, n_sectors);
+    if (rc != ESP_OK) {
+        ESP_LOGE(tag, "buzzer_src_read: failed %s", esp_err_to_name(rc));
+        return 0;
+    }
+    src->sector += n_sectors;
+    src->remain -= n;
+    return n;
+}
+
+
+/** wait the start time of the synchronized playback,
+ *  sleep first, then spin for the last `BUZZER_START_SPIN_USEC`.
+ */
+static void buzzer_sound_wait(int64_t start_usec) {
+    if (start_usec == 0) {return;}
+    auto wait = start_usec - esp_timer_get_time();
+    if (wait > BUZZER_START_MAX_USEC) {
+        ESP_LOGE(tag, "buzzer_sync: start too far ahead %d msec, ignored",
+                 (int)(wait / 1000));
+        return;
+    }
+    if (wait > BUZZER_START_SPIN_USEC) {
+        vTaskDelay(pdMS_TO_TICKS((wait - BUZZER_START_SPIN_USEC) / 1000));
+    }
+    while (esp_timer_get_time() < start_usec) {}
+    ESP_LOGI(tag, "buzzer_sync: start error %d usec (clock spread %d usec)",
+             (int)(esp_timer_get_time() - start_usec),
+             (int)buzzer_clock_spread());
+}
+
+
+static bool buzzer_sound(buzzer_src* src, int volume, int64_t start_usec) {
+    auto buf = audio_buf;
+    int64_t t_read = 0;
+    int n_bytes = 0;
+    auto read = [&] () {
+        auto t = esp_timer_get_time();
+        auto ret = buzzer_src_read(src, buf);
+        t_read += esp_timer_get_time() - t;
+        n_bytes += ret;
+        return ret;
+    };
+
+    int n_read = read();
+    if (n_read < BUZZER_WAV_HEADER) {
+        ESP_LOGE(tag, "buzzer_sound: too short %d bytes", n_read);
         return false;
     }
-    int8_t buf[BUZZER_BYTES_FRAME];
-    auto [bits, streao, tick] = buzzer_sound_read_format(fp);
+    auto [bits, streao, rate] = buzzer_sound_read_format(buf);
+    #if !CONFIG_BUZZER_EQ_NONE
+    auto eq = buzzer_eq_find(rate);
+    buzzer_biquad_state eq_states[2][BUZZER_EQ_BANDS] = {};
+    if (eq == nullptr) {
+        ESP_LOGE(tag, "buzzer_eq: %d Hz is not supported, bypassed", rate);
+    }
+    #endif
     #if 0
     i2s_chan_handle_t i2sch_tx = buzzer_sound_init();
     #else
-    dac_output_enable(buzzer_dac_ch);
+    if (!buzzer_dac_open(rate)) {return false;}
     #endif
+    buzzer_sound_wait(start_usec);
 
     const int n_limit = 1000000;
     auto n = 0;
+    auto ofs = BUZZER_WAV_HEADER;
     while (n++ < n_limit) {
-        auto n_read = fread(buf, sizeof(int8_t), BUZZER_BYTES_FRAME, fp);
-        if (n_read < 1) {break;}
         #if 0
         size_t n_write = 0;
         vTaskDelay(pdMS_TO_TICKS(BUZZER_MSEC_FRAME));
@@ -226,17 +498,36 @@ static bool buzzer_sound(FILE* fp) {
         if (ret != ESP_OK) {
             ESP_LOGE(tag, "i2s-write: failed");
         }
+        #elif !CONFIG_BUZZER_EQ_NONE
+        if (eq != nullptr) {
+            buzzer_sound_eq(buf + ofs, n_read - ofs, bits, streao,
+                            volume, *eq, eq_states);
+        } else {
+            buzzer_sound_loop(buf + ofs, n_read - ofs, bits, streao, volume);
+        }
         #else
-        buzzer_sound_loop(buf, n_read, bits, streao, tick);
+        buzzer_sound_loop(buf + ofs, n_read - ofs, bits, streao, volume);
         #endif
-        if (n_read < BUZZER_BYTES_FRAME) {break;}
+        if (n_read < BUZZER_BYTES_FRAME || preempted.load()) {break;}
+        ofs = 0;
+        n_read = read();
+        if (n_read < 1) {break;}
     }
     ESP_LOGI(tag, "buzzer_sound: loop %d times...", n);
-    dac_output_disable(buzzer_dac_ch);
+    ESP_LOGI(tag, "buzzer_sound: read %d bytes in %d usec, %d kB/s (%s)",
+             n_bytes, (int)t_read,
+             t_read > 0 ? (int)(n_bytes * 1000LL / t_read) : 0,
+             src->fp == nullptr ? "raw" : "file");
+    buzzer_dac_close();
     return true;
 }
 
 
+/** mount the card by the VFS FAT driver.
+ *  the driver allocates the FATFS and the card objects from the heap
+ *  while mounting and frees them by the unmount or a failed mount,
+ *  the only heap use of the card task (outside of the playback).
+ */
 static sdmmc_card_t* buzzer_mount_tf() {
     sdmmc_card_t *card;
     auto [mount_config, rc, host, slot_config] = buzzer_tf_init();
@@ -244,8 +535,7 @@ static sdmmc_card_t* buzzer_mount_tf() {
         return nullptr;
     }
 
-    auto ret = esp_vfs_fat_sdspi_mount(
-            mount_point, &host, &slot_config, &mount_config, &card);
+    auto ret = buzzer_tf_mount(host, slot_config, mount_config, &card);
     if (ret == ESP_FAIL) {
         ESP_LOGE(tag, "mmc-mount: Failed (not formatted)");
         return nullptr;
@@ -259,94 +549,439 @@ static sdmmc_card_t* buzzer_mount_tf() {
 }
 
 
-extern "C" void buzzer_task(void* params) {
-    static int32_t src = 1;
-    xQueueSend(queue, (void*)&src, (TickType_t)0);
+extern "C" void buzzer_report_task(void) {
+    auto n = n_report_tasks.load();
+    if (n >= BUZZER_REPORT_TASKS) {return;}
+    report_tasks[n] = xTaskGetCurrentTaskHandle();
+    n_report_tasks.store(n + 1);
+}
+
 
+/// the stack high-water marks of all reported tasks, and the heap.
+extern "C" void buzzer_report_memory(const char* when) {
+    char line[160];
+    int m = 0;
+    const int n = n_report_tasks.load();
+    for (int i = 0; i < n && m < (int)sizeof(line); i++) {
+        m += snprintf(&line[m], sizeof(line) - m, " %s %d",
+                      pcTaskGetName(report_tasks[i]),
+                      (int)uxTaskGetStackHighWaterMark(report_tasks[i]));
+    }
+    line[std::min(m, (int)sizeof(line) - 1)] = '\0';
+    ESP_LOGI(tag, "buzzer_mem: %s: min-free-heap %d bytes, stack-hwm (bytes)%s",
+             when, (int)esp_get_minimum_free_heap_size(), line);
+}
+
+
+static void buzzer_play(const buzzer_req* req) {
+    // - the catalog is swapped under `card_mutex`, held while playing.
+    const auto clip = catalog.load()->clips[req->sound];
     char fname[30] = {0};
-    sprintf(fname, "%s/%s", mount_point, (const char*)params);
+    sprintf(fname, "%s/%s", mount_point, clip.name);
     ESP_LOGE(tag, "buzzer: play %s.", fname);
 
-    auto card = buzzer_mount_tf();
-    auto f = fopen(fname, "r");
-    if (buzzer_sound(f)) {
-        fclose(f);
+    buzzer_src src = {nullptr, clip.sector, clip.n_bytes};
+    if (clip.sector == 0) {
+        src.fp = fopen(fname, "r");
+        if (src.fp == nullptr) {
+            ESP_LOGE(tag, "Failed to open file for reading");
+            return;
+        }
+        setvbuf(src.fp, nullptr, _IONBF, 0);  // - read to our buffer directly.
     }
-    esp_vfs_fat_sdcard_unmount(mount_point, card);
+    buzzer_sound(&src, req->volume + 1, req->start_usec);
+    if (src.fp != nullptr) {
+        fclose(src.fp);
+    }
+}
 
-    xQueueReset(queue);
 
-    for (;;) {
-        vTaskDelete(task_handle);
+/** play the synthesized sound, no TF card is needed.
+ */
+static void buzzer_play_synth(const buzzer_req* req) {
+    buzzer_synth syn;
+    if (!buzzer_synth_start(&syn, req->sound)) {return;}
+    ESP_LOGE(tag, "buzzer: play synth %s.", buzzer_synth_name(req->sound));
+
+    auto buf = (int16_t*)audio_buf;
+    const int len = BUZZER_BYTES_FRAME / sizeof(int16_t);
+    if (!buzzer_dac_open(BUZZER_SYNTH_RATE)) {return;}
+    buzzer_sound_wait(req->start_usec);
+    int n;
+    while (!preempted.load() &&
+           (n = buzzer_synth_render(syn, buf, len)) > 0) {
+        buzzer_sound_loop(audio_buf, n * sizeof(int16_t), 16, false,
+                          req->volume + 1);
     }
+    buzzer_dac_close();
 }
 
 
-extern "C" bool buzzer(const char* src) {
-    int tmp = 0;
-    if (xQueuePeek(queue, (void*)&tmp, (TickType_t)0)) {
-        ESP_LOGE(tag, "buzzer: duplicated playing ignored...");
-        return true;
+#if CONFIG_BUZZER_STREAM
+/** play the live stream from the hub, until it stops.
+ */
+static void buzzer_play_stream(const buzzer_req* req) {
+    static_assert(BUZZER_STREAM_FRAME * sizeof(int16_t) <= BUZZER_BYTES_FRAME);
+    ESP_LOGI(tag, "buzzer: play stream.");
+    auto buf = (int16_t*)audio_buf;
+    if (!buzzer_dac_open(BUZZER_STREAM_RATE)) {return;}
+    while (!preempted.load() && buzzer_stream_get(buf)) {
+        buzzer_sound_loop(audio_buf, BUZZER_STREAM_FRAME * sizeof(int16_t),
+                          16, false, req->volume + 1);
     }
-    xTaskCreatePinnedToCore(buzzer_task, BUZZER_TASKTAG, BUZZER_STACK_SIZE,
-                            (void*)src, 12, &task_handle, BUZZER_CPUCORE);
-    return false;
+    buzzer_dac_close();
+    buzzer_stream_report();
 }
+#endif
 
 
-extern "C" void buzzer_init_task(void* params) {
-    auto hnd_task = *(TaskHandle_t*)params;
+/** resolve the cluster chain of the file, return false if it can't be
+ *  opened, and the first card sector if it is stored contiguously,
+ *  or 0 to read it by the file, see `buzzer_clip.h`.
+ */
+static std::tuple<bool, uint32_t, uint32_t> buzzer_clip_resolve(
+        sdmmc_card_t* card, const char* fname
+) {
+    static FIL fil;  // - FIL has a sector buffer, keep it off the stack.
+    char path[30] = {0};
+    snprintf(path, sizeof(path), "%d:/%s",
+             (int)ff_diskio_get_pdrv_card(card), fname);
+    if (f_open(&fil, path, FA_READ) != FR_OK) {
+        return {false, 0, 0};
+    }
+    uint32_t n_bytes = f_size(&fil);
+    uint32_t sector = 0;
+    #if FF_USE_FASTSEEK
+    DWORD clmt[4] = {ARRAY_SIZE(clmt)};  // - room for just one fragment.
+    fil.cltbl = clmt;
+    if (n_bytes > 0) {
+        // - a fragmented file fails by `FR_NOT_ENOUGH_CORE`.
+        auto rc = f_lseek(&fil, CREATE_LINKMAP);
+        auto fs = fil.obj.fs;
+        #if FF_MAX_SS == FF_MIN_SS
+        const uint32_t fs_sector_size = FF_MAX_SS;
+        #else
+        const uint32_t fs_sector_size = fs->ssize;
+        #endif
+        const buzzer_clip_fs layout = {fs->database, fs->csize,
+                                       fs_sector_size,
+                                       card->csd.sector_size};
+        auto cluster = rc == FR_OK ?
+                buzzer_clip_cluster(clmt, ARRAY_SIZE(clmt)) : 0;
+        sector = buzzer_clip_sector(layout, cluster, BUZZER_BYTES_FRAME);
+        if (cluster != 0 && sector == 0) {
+            ESP_LOGE(tag, "buzzer_clip: %s at cluster %u is not aligned to "
+                     "%d bytes card sectors, by file", fname,
+                     (unsigned)cluster, (int)layout.card_ssize);
+        }
+    }
+    #endif
+    f_close(&fil);
+    return {true, sector, n_bytes};
+}
 
+
+/** rescan the card to the catalog not in use, only new or changed files
+ *  (name, size and mtime) are resolved again.
+ *  runs with `card_mutex`, the advertisements continue by `catalog`.
+ *  returns nullptr if the card can't be read.
+ */
+static buzzer_catalog* buzzer_catalog_refresh(sdmmc_card_t* card) {
     auto strendswith = [] (const char* s1, const char* s2) {
         auto len1 = strlen(s1);
         auto len2 = strlen(s2);
         return len1 >= len2 && !memcmp(&s1[len1] - len2, s2, len2);
     };
 
-    auto check_fname = [strendswith] (const char* src) {
+    auto cur = catalog_last;
+    auto next = cur == &catalogs[0] ? &catalogs[1] : &catalogs[0];
+    memset(next, 0, sizeof(*next));
+    next->serial = card->cid.serial;
+
+    auto check_fname = [strendswith, next] (const char* src) {
         auto ret = src[0] - '0';
         if (ret >= 0 && ret <= 9) {return ret;}
         if (!strendswith(src, ".WAV")) {return -1;}
-        for (int i = 0; i < ARRAY_SIZE(sounds); i++) {
-            if (sounds[i] == nullptr) {
+        for (int i = 0; i < ARRAY_SIZE(next->clips); i++) {
+            if (next->clips[i].name == nullptr) {
                 return i;
             }
         }
         return -1;
     };
 
-    auto card = buzzer_mount_tf();
+    auto find = [cur, next] (const char* fname) -> const buzzer_clip* {
+        if (cur->serial != next->serial) {return nullptr;}
+        for (const auto& i : cur->clips) {
+            if (i.name != nullptr && !strcmp(i.name, fname)) {return &i;}
+        }
+        return nullptr;
+    };
 
-    auto d = opendir(mount_point);
-    while (auto ent = readdir(d)) {
-        auto fname = ent->d_name;
-        ESP_LOGI(tag, "buzzer_init_task: %s", fname);
+    char path[8] = {0};
+    snprintf(path, sizeof(path), "%d:/",
+             (int)ff_diskio_get_pdrv_card(card));
+    FF_DIR dir;
+    if (f_opendir(&dir, path) != FR_OK) {
+        ESP_LOGE(tag, "buzzer_catalog: can't open %s", mount_point);
+        return nullptr;
+    }
+    size_t used = 0;
+    int n_same = 0;
+    int n_load = 0;
+    FILINFO fi;
+    while (f_readdir(&dir, &fi) == FR_OK && fi.fname[0] != '\0') {
+        if (fi.fattrib & AM_DIR) {continue;}
+        auto fname = fi.fname;
         auto n = check_fname(fname);
         if (n < 0) {continue;}
 
         auto len = strlen(fname);
-        sounds[n] = (char*)malloc(len + 1);
-        memcpy((void*)sounds[n], fname, len + 1);
-        ESP_LOGI(tag, "buzzer_init_task: stored to %d", n);
+        if (used + len + 1 > sizeof(next->arena)) {
+            ESP_LOGE(tag, "buzzer_catalog: arena full, skip %s", fname);
+            continue;
+        }
+        auto& clip = next->clips[n];
+        clip.name = &next->arena[used];
+        memcpy((void*)clip.name, fname, len + 1);
+        used += len + 1;
+        clip.n_bytes = fi.fsize;
+        clip.stamp = (fi.fdate << 16) | fi.ftime;
+
+        auto old = find(fname);
+        if (old != nullptr && old->n_bytes == clip.n_bytes &&
+                              old->stamp == clip.stamp) {
+            clip.sector = old->sector;
+            n_same++;
+            continue;
+        }
+        auto [ok, sector, n_bytes] = buzzer_clip_resolve(card, fname);
+        if (!ok) {
+            ESP_LOGE(tag, "buzzer_catalog: %s can't be opened, unavailable",
+                     fname);
+            clip = {};
+            used -= len + 1;
+            continue;
+        }
+        clip.sector = sector;
+        clip.n_bytes = n_bytes;
+        n_load++;
+        ESP_LOGI(tag, "buzzer_catalog: %s stored to %d (%d bytes, %s)",
+                 fname, n, (int)clip.n_bytes, clip.sector ? "raw" : "file");
+    }
+    f_closedir(&dir);
+
+    ESP_LOGI(tag, "buzzer_catalog: %d unchanged, %d loaded, arena %d/%d bytes",
+             n_same, n_load, (int)used, (int)sizeof(next->arena));
+    return next;
+}
+
+
+/** swap the card and the catalog, with `card_mutex`.
+ *  `next` nullptr for the removed card.
+ */
+static void buzzer_catalog_publish(sdmmc_card_t* card,
+                                   const buzzer_catalog* next) {
+    tf_card = card;
+    catalog.store(next != nullptr ? next : &catalog_none);
+    if (next != nullptr) {
+        catalog_last = next;
+    }
+}
+
+
+#if CONFIG_BUZZER_TF_BENCH
+/** measure the time to first byte and the read throughput
+ *  of the first clip, by raw sectors and by stdio.
+ */
+static void buzzer_tf_bench(int64_t t_mount) {
+    const buzzer_clip* clip = nullptr;
+    for (const auto& i : catalog.load()->clips) {
+        if (i.name != nullptr && i.sector != 0) {clip = &i; break;}
+    }
+    if (clip == nullptr) {
+        ESP_LOGE(tag, "tf-bench: no contiguous clip.");
+        return;
+    }
+    auto buf = audio_buf;
+    // - `t` is the start time, includes fopen for stdio.
+    auto run = [buf] (buzzer_src* src, int64_t t) {
+        int64_t t_first = 0;
+        int n_bytes = 0;
+        while (auto n = buzzer_src_read(src, buf)) {
+            if (t_first == 0) {t_first = esp_timer_get_time() - t;}
+            n_bytes += n;
+        }
+        t = esp_timer_get_time() - t;
+        auto bps = t > 0 ? (int)(n_bytes * 1000000LL / t) : 0;
+        return std::make_tuple((int)t_first, bps);
+    };
+
+    buzzer_src raw = {nullptr, clip->sector, clip->n_bytes};
+    auto [raw_first, raw_bps] = run(&raw, esp_timer_get_time());
+
+    char fname[30] = {0};
+    sprintf(fname, "%s/%s", mount_point, clip->name);
+    auto t = esp_timer_get_time();
+    buzzer_src file = {fopen(fname, "r"), 0, 0};
+    if (file.fp == nullptr) {return;}
+    setvbuf(file.fp, nullptr, _IONBF, 0);
+    auto [file_first, file_bps] = run(&file, t);
+    fclose(file.fp);
+
+    ESP_LOGI(tag, "tf-bench: %s %d-bit %d kHz, mount %d msec, %s %d bytes",
+             buzzer_tf_name, buzzer_bus_width, (int)tf_card->max_freq_khz,
+             (int)(t_mount / 1000), clip->name, (int)clip->n_bytes);
+    ESP_LOGI(tag, "tf-bench: raw  first byte %d usec, %d bytes/s",
+             raw_first, raw_bps);
+    ESP_LOGI(tag, "tf-bench: file first byte %d usec, %d bytes/s",
+             file_first, file_bps);
+}
+#endif
+
+
+bool buzzer_card_take(void) {
+    xSemaphoreTake(card_mutex, portMAX_DELAY);
+    if (tf_card != nullptr) {return true;}
+    xSemaphoreGive(card_mutex);
+    return false;
+}
+
+
+/** the new catalog is published before the mutex is given, so nobody
+ *  takes the card between the changed files and the catalog of them.
+ */
+void buzzer_card_give(bool refresh) {
+    if (refresh && tf_card != nullptr) {
+        if (auto next = buzzer_catalog_refresh(tf_card)) {
+            buzzer_catalog_publish(tf_card, next);
+        }
+    }
+    xSemaphoreGive(card_mutex);
+}
+
+
+/** watch the card, and refresh the catalog when it is inserted.
+ *  the status, the mount and the scan run with `card_mutex`, so the raw
+ *  reads of the playback never meet them on the bus: a playing sound
+ *  delays them, they delay the start of a sound.
+ *  retry of the mount slows down while the slot is empty.
+ */
+extern "C" void buzzer_card_task(void* params) {
+    buzzer_report_task();
+    auto delay = CONFIG_BUZZER_CARD_POLL_MS;
+    for (;;) {
+        xSemaphoreTake(card_mutex, portMAX_DELAY);
+        if (tf_card != nullptr) {
+            if (sdmmc_get_status(tf_card) != ESP_OK) {
+                ESP_LOGE(tag, "buzzer_card: removed.");
+                auto card = tf_card;
+                buzzer_catalog_publish(nullptr, nullptr);
+                esp_vfs_fat_sdcard_unmount(mount_point, card);
+            }
+        } else {
+            auto t_mount = esp_timer_get_time();
+            auto card = buzzer_mount_tf();
+            t_mount = esp_timer_get_time() - t_mount;
+            if (card != nullptr) {
+                buzzer_catalog_publish(card, buzzer_catalog_refresh(card));
+                #if CONFIG_BUZZER_TF_BENCH
+                buzzer_tf_bench(t_mount);
+                #endif
+                buzzer_report_memory("card");
+            }
+        }
+        xSemaphoreGive(card_mutex);
+
+        delay = tf_card != nullptr ? CONFIG_BUZZER_CARD_POLL_MS
+                                   : std::min(delay * 2, BUZZER_CARD_RETRY_MAX);
+        vTaskDelay(pdMS_TO_TICKS(delay));
     }
-    closedir(d);
+}
 
-    esp_vfs_fat_sdcard_unmount(mount_point, card);
 
-    dac_i2s_disable();
+extern "C" void buzzer_task(void* params) {
+    buzzer_report_task();
+    buzzer_report_memory("boot");
 
+    buzzer_req req;
     for (;;) {
-        vTaskDelete(hnd_task);
+        // - keep the request in the queue while playing.
+        if (!xQueuePeek(queue, (void*)&req, portMAX_DELAY)) {continue;}
+        #if CONFIG_PM_ENABLE
+        esp_pm_lock_acquire(pm_lock);
+        #endif
+        if (req.sound == BUZZER_STREAM_SOUND) {
+            #if CONFIG_BUZZER_STREAM
+            buzzer_play_stream(&req);
+            #endif
+        } else if (req.sound >= BUZZER_SYNTH_FIRST) {
+            buzzer_play_synth(&req);
+        } else {
+            xSemaphoreTake(card_mutex, portMAX_DELAY);
+            if (tf_card != nullptr) {
+                buzzer_play(&req);
+            }
+            xSemaphoreGive(card_mutex);
+        }
+        #if CONFIG_PM_ENABLE
+        esp_pm_lock_release(pm_lock);
+        #endif
+        // - keep the request of the preemption for the next.
+        xSemaphoreTake(queue_mutex, portMAX_DELAY);
+        if (!preempted.exchange(false)) {
+            xQueueReset(queue);
+        }
+        xSemaphoreGive(queue_mutex);
+        buzzer_report_memory("play");
     }
 }
 
 
+/** request the sound, a higher priority than the playing one
+ *  stops it and is played next. returns true if ignored.
+ */
+extern "C" bool buzzer(const buzzer_req* src) {
+    buzzer_req tmp;
+    auto ret = false;
+    xSemaphoreTake(queue_mutex, portMAX_DELAY);
+    if (!xQueuePeek(queue, (void*)&tmp, (TickType_t)0)) {
+        xQueueSend(queue, (void*)src, (TickType_t)0);
+    } else if (src->priority > tmp.priority) {
+        ESP_LOGI(tag, "buzzer: preempt %d (priority %d) by %d (priority %d)",
+                 tmp.sound, tmp.priority, src->sound, src->priority);
+        xQueueOverwrite(queue, (void*)src);
+        preempted.store(true);
+    } else {
+        ESP_LOGE(tag, "buzzer: duplicated playing ignored...");
+        ret = true;
+    }
+    xSemaphoreGive(queue_mutex);
+    return ret;
+}
+
+
 extern "C" void buzzer_init(void) {
-    queue = xQueueCreate(1, sizeof(int32_t));
+    queue = xQueueCreateStatic(1, sizeof(buzzer_req),
+                               queue_storage, &queue_buf);
     ESP_LOGI(tag, "buzzer_init: queue: %x", (int)queue);
-
-    xTaskCreatePinnedToCore(buzzer_init_task, BUZZER_TASKTAG, BUZZER_STACK_SIZE,
-                            &task_handle, 12, &task_handle, BUZZER_CPUCORE);
+    #if CONFIG_PM_ENABLE
+    // - the DAC timing needs full clock and no light sleep.
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0,
+                                       BUZZER_TASKTAG, &pm_lock));
+    #endif
+    buzzer_blog_init();
+    buzzer_adv_reset();
+    card_mutex = xSemaphoreCreateMutexStatic(&card_mutex_buf);
+    queue_mutex = xSemaphoreCreateMutexStatic(&queue_mutex_buf);
+
+    xTaskCreateStaticPinnedToCore(buzzer_task, BUZZER_TASKTAG,
+                                  BUZZER_STACK_SIZE, nullptr, 12,
+                                  task_stack, &task_buf, BUZZER_CPUCORE);
+    xTaskCreateStaticPinnedToCore(buzzer_card_task, BUZZER_CARD_TASKTAG,
+                                  BUZZER_STACK_SIZE, nullptr, 2,
+                                  card_task_stack, &card_task_buf,
+                                  tskNO_AFFINITY);
 }
 
 
@@ -354,16 +989,15 @@ extern "C" bool buzzer_check_addr(const uint8_t* src, int len) {
     static uint8_t peer_addr[6] = {0};
 
     if (const_strcmp(CONFIG_BUZZER_PEER_ADDR, "ADDR_ANY") == 0) {
-        ESP_LOGI(tag, "buzzer_chk_addr: any: %x:%x:%x:%x:%x:%x",
-                 src[5], src[4], src[3],
-                 src[2], src[1], src[0]);
+        BUZZER_BLOGD(ADDR_ANY, (src[5] << 16) | (src[4] << 8) | src[3],
+                               (src[2] << 16) | (src[1] << 8) | src[0]);
         return false;
     }
 
-    ESP_LOGI(tag, "Peer address from menuconfig: %s",
-             CONFIG_BUZZER_PEER_ADDR);
     /* Convert string to address */
     if (peer_addr[0] == 0) {
+        ESP_LOGI(tag, "Peer address from menuconfig: %s",
+                 CONFIG_BUZZER_PEER_ADDR);
         sscanf(CONFIG_BUZZER_PEER_ADDR, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
            &peer_addr[5], &peer_addr[4], &peer_addr[3],
            &peer_addr[2], &peer_addr[1], &peer_addr[0]);
@@ -372,81 +1006,128 @@ extern "C" bool buzzer_check_addr(const uint8_t* src, int len) {
 }
 
 
-bool buzzer_check_service(const struct ble_hs_adv_fields* fields) {
-    for (int i = 0; i < fields->num_uuids16; i++) {
-        if (ble_uuid_u16(&fields->uuids16[i].u) == BLECENT_SVC_ALERT_UUID) {
-            ESP_LOGI(tag, "buzzer_chk_serv: found %d/%d",
-                     i, fields->num_uuids16);
-            return false;
-        }
-    }
-    return true;
+/** measure the gaps between the advertisements from hubs,
+ *  the maximum is the detection latency of the scan schedule.
+ */
+static void buzzer_check_latency(int64_t usec) {
+    auto& s = latency_stats;
+    auto gap = usec - s.last;
+    s.last = usec;
+    if (gap > BUZZER_HUB_IDLE_USEC) {return;}  // - hub was not advertising.
+    s.sum += gap;
+    s.max = std::max(s.max, gap);
+    if (++s.n < BUZZER_LATENCY_REPORT) {return;}
+    ESP_LOGI(tag, "buzzer_latency: hub gap avg %d msec, max %d msec (%d advs)",
+             (int)(s.sum / s.n / 1000), (int)(s.max / 1000), s.n);
+    s.n = 0;
+    s.sum = s.max = 0;
 }
 
 
-static bool buzzer_check_history(uint16_t n_new) {
-    static int history_adv_n = 0;
-    static uint16_t history_adv[5] = {0, 0, 0, 0, 0};
-
-    const int N = ARRAY_SIZE(history_adv);
-    for (int i = 0; i < N; i++) {
-        if (history_adv[i] == n_new) {
-            ESP_LOGI(tag, "buzzer_chk_hist: found at %d(%d)", n_new, i);
-            return true;
-        }
+extern "C" void buzzer_adv_report(bool reset) {
+    ESP_LOGI(tag, "buzzer_adv: seen %u, accepted %u, rate-limited %u, "
+             "deduplicated %u",
+             (unsigned)adv_stats.seen, (unsigned)adv_stats.accepted,
+             (unsigned)adv_stats.rate_limited,
+             (unsigned)adv_stats.deduplicated);
+    for (int i = 0; i < filter.order.n; i++) {
+        auto s = filter.order.stages[i];
+        auto runs = filter.stats.runs[s];
+        ESP_LOGI(tag, "buzzer_adv: %d. %-7s rejected %u/%u, %u cycles/run",
+                 i + 1, buzzer_filter_names[s],
+                 (unsigned)filter.stats.rejects[s], (unsigned)runs,
+                 runs > 0 ? (unsigned)(filter.stats.cycles[s] / runs) : 0);
+    }
+    if (reset) {
+        adv_stats = {0, 0, 0, 0};
+        filter.stats = {};
     }
-    auto j = history_adv_n++;
-    history_adv_n = history_adv_n >= N ? 0: history_adv_n;
-    history_adv[j] = n_new;
-    ESP_LOGI(tag, "buzzer_chk_hist: update to %d(%d)", n_new, j);
-    return false;
 }
 
 
-extern "C" const char* buzzer_from_advertise(
-        const struct ble_gap_disc_desc* disc
-        // const struct ble_hs_adv_fields* fields
-) {
-    if (disc->event_type != BLE_HCI_ADV_RPT_EVTYPE_ADV_IND &&
-        disc->event_type != BLE_HCI_ADV_RPT_EVTYPE_DIR_IND) {
-        /*
-        ESP_LOGE(tag, "buzzer_from_adv: invalid type: %d", disc->event_type);
-        */
-        return nullptr;
-    }
-    if (buzzer_check_addr(disc->addr.val, sizeof(disc->addr.val))) {
-        return nullptr;
-    }
+/** clear the state of the advertisement path and the hub clock,
+ *  at the start and after the storm generator.
+ */
+extern "C" void buzzer_adv_reset(void) {
+    adv_stats = {0, 0, 0, 0};
+    buzzer_filter_init(filter, filter_skip, filter_reorder,
+                       CONFIG_BUZZER_TARGET_ID, CONFIG_BUZZER_ADV_RATE,
+                       CONFIG_BUZZER_ADV_BURST);
+    latency_stats = {0, 0, 0, 0};
+    buzzer_clock_reset();
+}
 
-    struct ble_hs_adv_fields fields;
-    auto rc = ble_hs_adv_parse_fields(&fields, disc->data, disc->length_data);
-    if (rc != 0) {
-        ESP_LOGE(tag, "buzzer_from_adv: can't parse fields: %d", rc);
-        return nullptr;
-    }
 
-    if (buzzer_check_service(&fields)) {
-        ESP_LOGI(tag, "buzzer_from_adv: dont have service.");
-        return nullptr;
+/// the device parts of the filter stages.
+struct buzzer_adv_env {
+    int64_t now() {return esp_timer_get_time();}
+    uint32_t cycles() {return esp_cpu_get_cycle_count();}
+
+    bool addr(const uint8_t* addr) {
+        return buzzer_check_addr(addr, 6);
     }
-    const char* result = nullptr;
-    int num = 0;
-    for (int i = 0; i < fields.mfg_data_len; i++) {
-        ESP_LOGI(tag, "buzzer_from_adv: data(%d)-%2x",
-                 i, fields.mfg_data[i]);
-        auto n = fields.mfg_data[i];
-        if (i == 3 || i == 4) {
-            num += n << (8 * (i - 3));
-            continue;
+
+    const char* payload(buzzer_filter_adv& adv) {
+        buzzer_check_latency(adv.usec);
+        if (adv.rec.timed) {
+            buzzer_clock_update(adv.rec.hub_msec, adv.usec);
         }
-        if (i != 2) {continue;}
-        if (n < ARRAY_SIZE(sounds)) {
-            result = sounds[n];
+        auto sound = adv.rec.sound;
+        if (sound >= BUZZER_SYNTH_FIRST) {
+            return buzzer_synth_name(sound);
+        } else if (sound >= 0 && sound < BUZZER_SOUNDS) {
+            return catalog.load()->clips[sound].name;
         }
-    }
-    if (result && buzzer_check_history(num)) {
         return nullptr;
     }
-    return result;
-}
 
+    void trace(buzzer_filter_stage stage, const buzzer_filter_adv& adv,
+               bool rejected, int value) {
+        auto a = adv.addr;
+        switch (stage) {
+        case BUZZER_FILTER_RATE:
+            if (!rejected) {return;}
+            adv_stats.rate_limited++;
+            BUZZER_BLOGD(RATE_LIMIT, (a[5] << 16) | (a[4] << 8) | a[3],
+                                     (a[2] << 16) | (a[1] << 8) | a[0]);
+            return;
+        case BUZZER_FILTER_SERVICE:
+            if (value == BUZZER_ADV_MALFORMED) {
+                BUZZER_BLOGE(ADV_PARSE, adv.len);
+            } else if (rejected) {
+                BUZZER_BLOGD(SERV_NONE);
+            } else {
+                BUZZER_BLOGD(SERV_FOUND, value);
+            }
+            return;
+        case BUZZER_FILTER_HISTORY:
+            if (rejected) {
+                adv_stats.deduplicated++;
+                BUZZER_BLOGI(HIST_FOUND, adv.rec.seq, value);
+            } else {
+                BUZZER_BLOGI(HIST_UPDATE, adv.rec.seq, value);
+            }
+            return;
+        default:
+            return;
+        }
+    }
+};
+
+
+extern "C" const char* buzzer_from_advertise(
+        const struct ble_gap_disc_desc* disc, buzzer_req* req
+) {
+    adv_stats.seen++;
+    buzzer_adv_env env;
+    auto adv = buzzer_filter_adv_of(disc->event_type, disc->addr.val,
+                                    disc->data, disc->length_data, 0);
+    if (!buzzer_filter_pass(filter, adv, env)) {return nullptr;}
+    adv_stats.accepted++;
+    auto& rec = adv.rec;
+    req->sound = rec.sound;
+    req->priority = rec.priority;
+    req->volume = rec.volume;
+    req->start_usec = rec.timed ? buzzer_clock_to_local(rec.start_msec) : 0;
+    return adv.result;
+}
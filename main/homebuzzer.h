@@ -15,6 +15,21 @@
 
 #define BUZZER_BYTES_FRAME 2048
 #define BUZZER_MSEC_FRAME  200
+#define BUZZER_WAV_HEADER  44    /// bytes before the data section
+
+#define BUZZER_MOUNT_POINT "/sdcard"
+#define BUZZER_SOUNDS 10         /// sounds in the catalog
+#define BUZZER_CATALOG_ARENA 512 /// bytes for the filenames of the sounds
+#define BUZZER_SYNTH_FIRST 0x80  /// sound numbers from here are synthesized
+#define BUZZER_STREAM_SOUND 0xFE /// sound number of the live stream
+#define BUZZER_CARD_RETRY_MAX 30000  /// msec, mount retry without the card
+#define BUZZER_STORM_SENDERS 32  /// senders of the storm generator
+#define BUZZER_RATE_SENDERS BUZZER_STORM_SENDERS  /// tracked by the rate limiter
+#define BUZZER_LATENCY_REPORT 100    /// hub advertisements per report
+#define BUZZER_HUB_IDLE_USEC 10000000 /// longer gaps are not measured
+#define BUZZER_START_SPIN_USEC 2000   /// busy-wait before the start time
+#define BUZZER_START_MAX_USEC 5000000 /// start times later than this are ignored
+#define BUZZER_REPORT_TASKS 8         /// tasks in the memory report
 
 
 #if CONFIG_IDF_TARGET_ESP32
@@ -34,11 +49,27 @@
 extern "C" {
 #endif
 
+/// a sound request decoded from the advertisement.
+struct buzzer_req {
+    uint8_t sound;      /// index of the sounds table
+    uint8_t priority;
+    uint8_t volume;     /// 255 for full scale
+    int64_t start_usec; /// local time to start (esp_timer), 0 for now
+};
+
 extern bool buzzer_check_addr(const uint8_t* src, int len);
 extern const char* buzzer_from_advertise(
-        const struct ble_gap_disc_desc* disc);
+        const struct ble_gap_disc_desc* disc, struct buzzer_req* req);
 extern void buzzer_init(void);
-extern bool buzzer(const char* sound_name);
+extern bool buzzer(const struct buzzer_req* req);
+extern void buzzer_adv_report(bool reset);
+extern void buzzer_adv_reset(void);
+extern void buzzer_adv_storm(void);
+extern void buzzer_synth_bench(void);
+extern void buzzer_eq_bench(void);
+extern void buzzer_upload_init(void);
+extern void buzzer_report_task(void);
+extern void buzzer_report_memory(const char* when);
 
 #if defined(__cplusplus)
 }
@@ -50,5 +81,12 @@ constexpr int const_strcmp(char const* l, char const* r) {
          : const_strcmp(l + 1, r + 1);
 }
 
+
+/// take the TF card for the file system, false without the card.
+extern bool buzzer_card_take(void);
+
+/// give the card back, refresh the catalog before it if `refresh`.
+extern void buzzer_card_give(bool refresh);
+
 #endif
 
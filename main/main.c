@@ -17,7 +17,13 @@
  * under the License.
  */
 
+#include <stdio.h>
+#include <string.h>
+
 #include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "nvs_flash.h"
 /* BLE */
 #include "nimble/nimble_port.h"
@@ -32,11 +38,138 @@
 #include "homebuzzer.h"
 
 
+#define BLECENT_CACHE_NVS "gattcache"  /* NVS namespace of the handle cache */
+
 static const char *tag = TAG_BUZZER;
 static int blecent_gap_event(struct ble_gap_event *event, void *arg);
 
 void ble_store_config_init(void);
 
+#if CONFIG_BUZZER_ADV_BENCH
+/**
+ * Measures the host task time per advertisement, and reports it for each
+ * BUZZER_ADV_BENCH_COUNT advertisements.
+ */
+static void
+blecent_adv_bench(int64_t t_start)
+{
+    static int n = 0;
+    static int64_t sum = 0;
+    static int64_t max = 0;
+#if CONFIG_BUZZER_BLOG_DEFERRED
+    const char *mode = "deferred";
+#else
+    const char *mode = "direct";
+#endif
+
+    int64_t t = esp_timer_get_time() - t_start;
+    sum += t;
+    max = t > max ? t : max;
+    if (++n < CONFIG_BUZZER_ADV_BENCH_COUNT) {
+        return;
+    }
+    ESP_LOGI(tag, "adv-bench: %d advs, avg %d.%02d usec, max %d usec (%s)",
+             n, (int)(sum / n), (int)((sum * 100 / n) % 100), (int)max,
+             mode);
+    buzzer_adv_report(false);
+    n = 0;
+    sum = max = 0;
+}
+#endif
+
+/**
+ * GATT handles of the Alert Notification service used by the read, write and
+ * subscribe procedures.  They are cached in NVS per peer, so a reconnect can
+ * skip the service discovery.
+ */
+struct blecent_handles {
+    uint16_t sup_new_alert_cat;     /* value of Supported New Alert Category */
+    uint16_t alert_not_ctrl_pt;     /* value of Alert Notification Control Point */
+    uint16_t unr_alert_stat_cccd;   /* CCCD of Unread Alert Status */
+};
+
+static struct {
+    uint16_t conn_handle;           /* BLE_HS_CONN_HANDLE_NONE if none */
+    ble_addr_t peer_addr;
+    struct blecent_handles hnd;
+    bool cached;                    /* handles came from NVS */
+    int64_t t_connect;
+} blecent_conn = {.conn_handle = BLE_HS_CONN_HANDLE_NONE};
+
+static void blecent_on_disc_complete(const struct peer *peer, int status,
+                                     void *arg);
+
+/**
+ * Makes the NVS key of the peer: address type and 12 hex digits.
+ */
+static void
+blecent_cache_key(const ble_addr_t *addr, char *key)
+{
+    snprintf(key, 16, "%d%02x%02x%02x%02x%02x%02x", addr->type,
+            addr->val[5], addr->val[4], addr->val[3],
+            addr->val[2], addr->val[1], addr->val[0]);
+}
+
+static int
+blecent_cache_load(const ble_addr_t *addr, struct blecent_handles *hnd)
+{
+    nvs_handle_t nvs;
+    char key[16];
+    size_t len = sizeof(*hnd);
+    int rc;
+
+    rc = nvs_open(BLECENT_CACHE_NVS, NVS_READONLY, &nvs);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    blecent_cache_key(addr, key);
+    rc = nvs_get_blob(nvs, key, hnd, &len);
+    nvs_close(nvs);
+    if (rc == ESP_OK && len != sizeof(*hnd)) {
+        rc = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    return rc;
+}
+
+static void
+blecent_cache_save(const ble_addr_t *addr, const struct blecent_handles *hnd)
+{
+    nvs_handle_t nvs;
+    char key[16];
+
+    if (nvs_open(BLECENT_CACHE_NVS, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    blecent_cache_key(addr, key);
+    if (hnd == NULL) {
+        nvs_erase_key(nvs, key);
+    } else {
+        nvs_set_blob(nvs, key, hnd, sizeof(*hnd));
+    }
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+/**
+ * The cached handles failed: forget them and discover the services again.
+ */
+static int
+blecent_rediscover(uint16_t conn_handle)
+{
+    int rc;
+
+    MODLOG_DFLT(ERROR, "Cached GATT handles failed; rediscover\n");
+    blecent_cache_save(&blecent_conn.peer_addr, NULL);
+    blecent_conn.cached = false;
+
+    rc = peer_disc_all(conn_handle, blecent_on_disc_complete, NULL);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "Failed to discover services; rc=%d\n", rc);
+        return ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+    }
+    return 0;
+}
+
 /**
  * Application callback.  Called when the attempt to subscribe to notifications
  * for the ANS Unread Alert Status characteristic has completed.
@@ -50,6 +183,23 @@ blecent_on_subscribe(uint16_t conn_handle,
     MODLOG_DFLT(INFO, "Subscribe complete; status=%d conn_handle=%d "
                 "attr_handle=%d\n",
                 error->status, conn_handle, attr->handle);
+    if (error->status != 0 && blecent_conn.cached) {
+        return blecent_rediscover(conn_handle);
+    }
+    if (error->status == 0) {
+        MODLOG_DFLT(INFO, "GATT ready; %d msec after connect (%s)\n",
+                    (int)((esp_timer_get_time() - blecent_conn.t_connect) /
+                          1000),
+                    blecent_conn.cached ? "cached" : "discovered");
+#if CONFIG_BUZZER_HUB_RECONNECT_BENCH
+        /* Reconnect once, by the handles just cached. */
+        static bool reconnected = false;
+        if (!blecent_conn.cached && !reconnected) {
+            reconnected = true;
+            return ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        }
+#endif
+    }
 
     return 0;
 }
@@ -67,29 +217,21 @@ blecent_on_write(uint16_t conn_handle,
     MODLOG_DFLT(INFO,
                 "Write complete; status=%d conn_handle=%d attr_handle=%d\n",
                 error->status, conn_handle, attr->handle);
+    if (error->status != 0 && blecent_conn.cached) {
+        return blecent_rediscover(conn_handle);
+    }
 
     /* Subscribe to notifications for the Unread Alert Status characteristic.
      * A central enables notifications by writing two bytes (1, 0) to the
      * characteristic's client-characteristic-configuration-descriptor (CCCD).
      */
-    const struct peer_dsc *dsc;
     uint8_t value[2];
     int rc;
-    const struct peer *peer = peer_find(conn_handle);
-
-    dsc = peer_dsc_find_uuid(peer,
-                             BLE_UUID16_DECLARE(BLECENT_SVC_ALERT_UUID),
-                             BLE_UUID16_DECLARE(BLECENT_CHR_UNR_ALERT_STAT_UUID),
-                             BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16));
-    if (dsc == NULL) {
-        MODLOG_DFLT(ERROR, "Error: Peer lacks a CCCD for the Unread Alert "
-                    "Status characteristic\n");
-        goto err;
-    }
 
     value[0] = 1;
     value[1] = 0;
-    rc = ble_gattc_write_flat(conn_handle, dsc->dsc.handle,
+    rc = ble_gattc_write_flat(conn_handle,
+                              blecent_conn.hnd.unr_alert_stat_cccd,
                               value, sizeof value, blecent_on_subscribe, NULL);
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "Error: Failed to subscribe to characteristic; "
@@ -100,7 +242,7 @@ blecent_on_write(uint16_t conn_handle,
     return 0;
 err:
     /* Terminate the connection. */
-    return ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+    return ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
 }
 
 /**
@@ -120,27 +262,19 @@ blecent_on_read(uint16_t conn_handle,
         print_mbuf(attr->om);
     }
     MODLOG_DFLT(INFO, "\n");
+    if (error->status != 0 && blecent_conn.cached) {
+        return blecent_rediscover(conn_handle);
+    }
 
     /* Write two bytes (99, 100) to the alert-notification-control-point
      * characteristic.
      */
-    const struct peer_chr *chr;
     uint8_t value[2];
     int rc;
-    const struct peer *peer = peer_find(conn_handle);
-
-    chr = peer_chr_find_uuid(peer,
-                             BLE_UUID16_DECLARE(BLECENT_SVC_ALERT_UUID),
-                             BLE_UUID16_DECLARE(BLECENT_CHR_ALERT_NOT_CTRL_PT));
-    if (chr == NULL) {
-        MODLOG_DFLT(ERROR, "Error: Peer doesn't support the Alert "
-                    "Notification Control Point characteristic\n");
-        goto err;
-    }
 
     value[0] = 99;
     value[1] = 100;
-    rc = ble_gattc_write_flat(conn_handle, chr->chr.val_handle,
+    rc = ble_gattc_write_flat(conn_handle, blecent_conn.hnd.alert_not_ctrl_pt,
                               value, sizeof value, blecent_on_write, NULL);
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "Error: Failed to write characteristic; rc=%d\n",
@@ -151,7 +285,7 @@ blecent_on_read(uint16_t conn_handle,
     return 0;
 err:
     /* Terminate the connection. */
-    return ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+    return ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
 }
 
 /**
@@ -161,28 +295,16 @@ err:
  * 3. After write is completed, subscribes to notifications for the ANS Unread Alert Status
  *    characteristic.
  *
- * If the peer does not support a required service, characteristic, or
- * descriptor, then the peer lied when it claimed support for the alert
- * notification service!  When this happens, or if a GATT procedure fails,
- * this function immediately terminates the connection.
+ * The handles come from the service discovery or the NVS cache.  If a GATT
+ * procedure fails, this function immediately terminates the connection.
  */
 static void
-blecent_read_write_subscribe(const struct peer *peer)
+blecent_read_write_subscribe(uint16_t conn_handle)
 {
-    const struct peer_chr *chr;
     int rc;
 
     /* Read the supported-new-alert-category characteristic. */
-    chr = peer_chr_find_uuid(peer,
-                             BLE_UUID16_DECLARE(BLECENT_SVC_ALERT_UUID),
-                             BLE_UUID16_DECLARE(BLECENT_CHR_SUP_NEW_ALERT_CAT_UUID));
-    if (chr == NULL) {
-        MODLOG_DFLT(ERROR, "Error: Peer doesn't support the Supported New "
-                    "Alert Category characteristic\n");
-        goto err;
-    }
-
-    rc = ble_gattc_read(peer->conn_handle, chr->chr.val_handle,
+    rc = ble_gattc_read(conn_handle, blecent_conn.hnd.sup_new_alert_cat,
                         blecent_on_read, NULL);
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "Error: Failed to read characteristic; rc=%d\n",
@@ -193,7 +315,56 @@ blecent_read_write_subscribe(const struct peer *peer)
     return;
 err:
     /* Terminate the connection. */
-    ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+    ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+}
+
+/**
+ * Picks the handles from the discovered database of the peer.
+ *
+ * If the peer does not support a required service, characteristic, or
+ * descriptor, then the peer lied when it claimed support for the alert
+ * notification service!
+ *
+ * @return                      0 if all handles are found.
+ */
+static int
+blecent_handles_from_peer(const struct peer *peer,
+                          struct blecent_handles *hnd)
+{
+    const struct peer_chr *chr;
+    const struct peer_dsc *dsc;
+
+    chr = peer_chr_find_uuid(peer,
+                             BLE_UUID16_DECLARE(BLECENT_SVC_ALERT_UUID),
+                             BLE_UUID16_DECLARE(BLECENT_CHR_SUP_NEW_ALERT_CAT_UUID));
+    if (chr == NULL) {
+        MODLOG_DFLT(ERROR, "Error: Peer doesn't support the Supported New "
+                    "Alert Category characteristic\n");
+        return BLE_HS_ENOENT;
+    }
+    hnd->sup_new_alert_cat = chr->chr.val_handle;
+
+    chr = peer_chr_find_uuid(peer,
+                             BLE_UUID16_DECLARE(BLECENT_SVC_ALERT_UUID),
+                             BLE_UUID16_DECLARE(BLECENT_CHR_ALERT_NOT_CTRL_PT));
+    if (chr == NULL) {
+        MODLOG_DFLT(ERROR, "Error: Peer doesn't support the Alert "
+                    "Notification Control Point characteristic\n");
+        return BLE_HS_ENOENT;
+    }
+    hnd->alert_not_ctrl_pt = chr->chr.val_handle;
+
+    dsc = peer_dsc_find_uuid(peer,
+                             BLE_UUID16_DECLARE(BLECENT_SVC_ALERT_UUID),
+                             BLE_UUID16_DECLARE(BLECENT_CHR_UNR_ALERT_STAT_UUID),
+                             BLE_UUID16_DECLARE(BLE_GATT_DSC_CLT_CFG_UUID16));
+    if (dsc == NULL) {
+        MODLOG_DFLT(ERROR, "Error: Peer lacks a CCCD for the Unread Alert "
+                    "Status characteristic\n");
+        return BLE_HS_ENOENT;
+    }
+    hnd->unr_alert_stat_cccd = dsc->dsc.handle;
+    return 0;
 }
 
 /**
@@ -218,10 +389,46 @@ blecent_on_disc_complete(const struct peer *peer, int status, void *arg)
     MODLOG_DFLT(INFO, "Service discovery complete; status=%d "
                 "conn_handle=%d\n", status, peer->conn_handle);
 
+    if (blecent_handles_from_peer(peer, &blecent_conn.hnd) != 0) {
+        ble_gap_terminate(peer->conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        return;
+    }
+    blecent_cache_save(&blecent_conn.peer_addr, &blecent_conn.hnd);
+
     /* Now perform three GATT procedures against the peer: read,
      * write, and subscribe to notifications.
      */
-    blecent_read_write_subscribe(peer);
+    blecent_read_write_subscribe(peer->conn_handle);
+}
+
+/**
+ * Derives the scan window and interval from the detection latency budget
+ * BUZZER_SCAN_LATENCY_MS.
+ *
+ * A window of the hub advertising interval + 10ms (advDelay) catches at
+ * least one advertisement, so the worst-case latency is the interval.
+ */
+static void
+blecent_scan_schedule(struct ble_gap_disc_params *disc_params)
+{
+#if CONFIG_BUZZER_SCAN_LATENCY_MS > 0
+    int itvl = CONFIG_BUZZER_SCAN_LATENCY_MS;
+    int window = CONFIG_BUZZER_HUB_ADV_INTERVAL_MS + 10;
+
+    itvl = itvl > 10240 ? 10240 : itvl;
+    window = window > itvl ? itvl : window;
+    disc_params->itvl = BLE_GAP_SCAN_ITVL_MS(itvl);
+    disc_params->window = BLE_GAP_SCAN_WIN_MS(window);
+
+    ESP_LOGI(tag, "scan: window %d msec, interval %d msec, "
+             "duty %d.%d%%, worst latency %d msec",
+             window, itvl, window * 100 / itvl, window * 1000 / itvl % 10,
+             itvl);
+#else
+    /* Use defaults: continuous scan. */
+    disc_params->itvl = 0;
+    disc_params->window = 0;
+#endif
 }
 
 /**
@@ -253,9 +460,10 @@ blecent_scan(void)
      */
     disc_params.passive = 1;
 
+    /* Duty-cycle the scan to the latency budget. */
+    blecent_scan_schedule(&disc_params);
+
     /* Use defaults for the rest of the parameters. */
-    disc_params.itvl = 0;
-    disc_params.window = 0;
     disc_params.filter_policy = 0;
     disc_params.limited = 0;
 
@@ -267,6 +475,188 @@ blecent_scan(void)
     }
 }
 
+#if CONFIG_BUZZER_HUB_CONNECT
+/**
+ * Checks the advertiser is the hub: connectable, at BUZZER_PEER_ADDR and
+ * with the Alert Notification service.  One connection at a time.
+ */
+static int
+blecent_should_connect(const struct ble_gap_disc_desc *disc)
+{
+    struct ble_hs_adv_fields fields;
+    int rc;
+    int i;
+
+    if (strcmp(CONFIG_BUZZER_PEER_ADDR, "ADDR_ANY") == 0) {
+        return 0;
+    }
+    if (blecent_conn.conn_handle != BLE_HS_CONN_HANDLE_NONE ||
+            ble_gap_conn_active()) {
+        return 0;
+    }
+
+    /* The device has to be advertising connectability. */
+    if (disc->event_type != BLE_HCI_ADV_RPT_EVTYPE_ADV_IND &&
+            disc->event_type != BLE_HCI_ADV_RPT_EVTYPE_DIR_IND) {
+        return 0;
+    }
+    if (buzzer_check_addr(disc->addr.val, sizeof(disc->addr.val))) {
+        return 0;
+    }
+
+    rc = ble_hs_adv_parse_fields(&fields, disc->data, disc->length_data);
+    if (rc != 0) {
+        return 0;
+    }
+    for (i = 0; i < fields.num_uuids16; i++) {
+        if (ble_uuid_u16(&fields.uuids16[i].u) == BLECENT_SVC_ALERT_UUID) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Connects to the advertiser if it is the hub.  The scan is stopped for
+ * the connect, and resumed by the connect event.
+ */
+static void
+blecent_connect_if_interesting(const struct ble_gap_disc_desc *disc)
+{
+    uint8_t own_addr_type;
+    int rc;
+
+    if (!blecent_should_connect(disc)) {
+        return;
+    }
+
+    /* Scanning must be stopped before a connection can be initiated. */
+    rc = ble_gap_disc_cancel();
+    if (rc != 0) {
+        MODLOG_DFLT(DEBUG, "Failed to cancel scan; rc=%d\n", rc);
+        return;
+    }
+
+    rc = ble_hs_id_infer_auto(0, &own_addr_type);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "error determining address type; rc=%d\n", rc);
+        blecent_scan();
+        return;
+    }
+
+    rc = ble_gap_connect(own_addr_type, &disc->addr, 30000, NULL,
+                         blecent_gap_event, NULL);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "Error: Failed to connect to the hub; rc=%d\n",
+                    rc);
+        blecent_scan();
+    }
+}
+#endif
+
+#if CONFIG_BUZZER_UPLOAD
+static int blecent_upload_event(struct ble_gap_event *event, void *arg);
+
+/**
+ * Advertises connectable with the device name, so the hub can connect and
+ * open the upload channel.  The scan keeps running.
+ */
+static void
+blecent_advertise(void)
+{
+    struct ble_gap_adv_params adv_params;
+    struct ble_hs_adv_fields fields;
+    const char *name;
+    uint8_t own_addr_type;
+    int rc;
+
+    rc = ble_hs_id_infer_auto(0, &own_addr_type);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "error determining address type; rc=%d\n", rc);
+        return;
+    }
+
+    memset(&fields, 0, sizeof fields);
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    name = ble_svc_gap_device_name();
+    fields.name = (uint8_t *)name;
+    fields.name_len = strlen(name);
+    fields.name_is_complete = 1;
+    rc = ble_gap_adv_set_fields(&fields);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "error setting advertisement data; rc=%d\n", rc);
+        return;
+    }
+
+    memset(&adv_params, 0, sizeof adv_params);
+    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params,
+                           blecent_upload_event, NULL);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "error enabling advertisement; rc=%d\n", rc);
+    }
+}
+
+/**
+ * GAP events of the connections from the hub.  The buzzer asks for the
+ * encryption at once, the upload channel is accepted only after it.
+ */
+static int
+blecent_upload_event(struct ble_gap_event *event, void *arg)
+{
+    struct ble_gap_conn_desc desc;
+    int rc;
+
+    switch (event->type) {
+    case BLE_GAP_EVENT_CONNECT:
+        MODLOG_DFLT(INFO, "upload: connection %s; status=%d\n",
+                    event->connect.status == 0 ? "established" : "failed",
+                    event->connect.status);
+        if (event->connect.status != 0) {
+            blecent_advertise();
+            return 0;
+        }
+        rc = ble_gap_security_initiate(event->connect.conn_handle);
+        if (rc != 0) {
+            MODLOG_DFLT(ERROR, "upload: can't initiate security; rc=%d\n",
+                        rc);
+            return ble_gap_terminate(event->connect.conn_handle,
+                                     BLE_ERR_REM_USER_CONN_TERM);
+        }
+        return 0;
+
+    case BLE_GAP_EVENT_DISCONNECT:
+        MODLOG_DFLT(INFO, "upload: disconnect; reason=%d\n",
+                    event->disconnect.reason);
+        blecent_advertise();
+        return 0;
+
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        blecent_advertise();
+        return 0;
+
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        MODLOG_DFLT(INFO, "upload: encryption change; status=%d\n",
+                    event->enc_change.status);
+        if (event->enc_change.status != 0) {
+            return ble_gap_terminate(event->enc_change.conn_handle,
+                                     BLE_ERR_AUTH_FAIL);
+        }
+        return 0;
+
+    case BLE_GAP_EVENT_REPEAT_PAIRING:
+        /* The hub lost the bond: forget ours and pair again. */
+        rc = ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc);
+        assert(rc == 0);
+        ble_store_util_delete_peer(&desc.peer_id_addr);
+        return BLE_GAP_REPEAT_PAIRING_RETRY;
+
+    default:
+        return 0;
+    }
+}
+#endif
 
 /**
  * The nimble host executes this callback when a GAP event occurs.  The
@@ -286,30 +676,43 @@ static int
 blecent_gap_event(struct ble_gap_event *event, void *arg)
 {
     struct ble_gap_conn_desc desc;
+    struct buzzer_req req;
+    const char *sndname;
+#if CONFIG_BUZZER_PRINT_ADV_FIELDS
     struct ble_hs_adv_fields fields;
+#endif
+#if CONFIG_BUZZER_ADV_BENCH
+    int64_t t_start;
+#endif
     int rc;
 
     switch (event->type) {
     case BLE_GAP_EVENT_DISC:
+    #if CONFIG_BUZZER_ADV_BENCH
+        t_start = esp_timer_get_time();
+    #endif
+    #if CONFIG_BUZZER_PRINT_ADV_FIELDS
         rc = ble_hs_adv_parse_fields(&fields, event->disc.data,
                                      event->disc.length_data);
-        if (rc != 0) {
-            return 0;
+        if (rc == 0) {
+            /* An advertisment report was received during GAP discovery. */
+            print_adv_fields(&fields);
         }
+    #endif
 
-        /* An advertisment report was received during GAP discovery. */
-        print_adv_fields(&fields);
-
-        #if 0  /// - homebuzzer does not need to connect, see blecent sample.
+        #if CONFIG_BUZZER_HUB_CONNECT
         blecent_connect_if_interesting(&event->disc);
         #endif
-        const char* sndname = buzzer_from_advertise(
-                &event->disc);
+        sndname = buzzer_from_advertise(&event->disc, &req);
+    #if CONFIG_BUZZER_ADV_BENCH
+        blecent_adv_bench(t_start);
+    #endif
         if (sndname == NULL) {
             return 0;
         }
-        ESP_LOGI(tag, "advertise: buzzer new %s", sndname);
-        buzzer(sndname);
+        ESP_LOGI(tag, "advertise: buzzer new %s (pri %d, vol %d)",
+                 sndname, req.priority, req.volume);
+        buzzer(&req);
         return 0;
 
     case BLE_GAP_EVENT_CONNECT:
@@ -322,6 +725,12 @@ blecent_gap_event(struct ble_gap_event *event, void *arg)
             assert(rc == 0);
             print_conn_desc(&desc);
             MODLOG_DFLT(INFO, "\n");
+            blecent_conn.t_connect = esp_timer_get_time();
+            blecent_conn.conn_handle = event->connect.conn_handle;
+            blecent_conn.peer_addr = desc.peer_id_addr;
+
+            /* Keep scanning for the alerts while connected. */
+            blecent_scan();
 
             /* Remember peer. */
             rc = peer_add(event->connect.conn_handle);
@@ -330,6 +739,14 @@ blecent_gap_event(struct ble_gap_event *event, void *arg)
                 return 0;
             }
 
+            /* Skip the discovery with the cached handles. */
+            blecent_conn.cached = blecent_cache_load(
+                    &blecent_conn.peer_addr, &blecent_conn.hnd) == ESP_OK;
+            if (blecent_conn.cached) {
+                blecent_read_write_subscribe(event->connect.conn_handle);
+                return 0;
+            }
+
             /* Perform service discovery. */
             rc = peer_disc_all(event->connect.conn_handle,
                                blecent_on_disc_complete, NULL);
@@ -354,9 +771,12 @@ blecent_gap_event(struct ble_gap_event *event, void *arg)
 
         /* Forget about peer. */
         peer_delete(event->disconnect.conn.conn_handle);
+        blecent_conn.conn_handle = BLE_HS_CONN_HANDLE_NONE;
 
-        /* Resume scanning. */
-        blecent_scan();
+        /* Resume scanning, unless it continued while connected. */
+        if (!ble_gap_disc_active()) {
+            blecent_scan();
+        }
         return 0;
 
     case BLE_GAP_EVENT_DISC_COMPLETE:
@@ -433,11 +853,16 @@ blecent_on_sync(void)
 
     /* Begin scanning for a peripheral to connect to. */
     blecent_scan();
+#if CONFIG_BUZZER_UPLOAD
+    /* Be connectable for the upload channel. */
+    blecent_advertise();
+#endif
 }
 
 void blecent_host_task(void *param)
 {
     ESP_LOGI(tag, "BLE Host Task Started");
+    buzzer_report_task();
     /* This function will return only when nimble_port_stop() is executed */
     nimble_port_run();
 
@@ -456,11 +881,31 @@ app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_BUZZER_LIGHT_SLEEP
+    /* Sleep automatically between the scan windows. */
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 40,
+        .light_sleep_enable = true,
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#endif
+
     nimble_port_init();
     /* Configure the host. */
     ble_hs_cfg.reset_cb = blecent_on_reset;
     ble_hs_cfg.sync_cb = blecent_on_sync;
     ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+#if CONFIG_BUZZER_UPLOAD
+    /* Bond with the hub (just works), the upload needs the encryption. */
+    ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_NO_IO;
+    ble_hs_cfg.sm_bonding = 1;
+    ble_hs_cfg.sm_sc = 1;
+    ble_hs_cfg.sm_our_key_dist = BLE_SM_PAIR_KEY_DIST_ENC |
+                                 BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist = BLE_SM_PAIR_KEY_DIST_ENC |
+                                   BLE_SM_PAIR_KEY_DIST_ID;
+#endif
 
     /* Initialize data structures to track connected peers. */
     rc = peer_init(MYNEWT_VAL(BLE_MAX_CONNECTIONS), 64, 64, 64);
@@ -474,6 +919,18 @@ app_main(void)
     ble_store_config_init();
 
     buzzer_init();
+#if CONFIG_BUZZER_UPLOAD
+    buzzer_upload_init();
+#endif
+#if CONFIG_BUZZER_ADV_STORM
+    buzzer_adv_storm();
+#endif
+#if CONFIG_BUZZER_SYNTH_BENCH
+    buzzer_synth_bench();
+#endif
+#if CONFIG_BUZZER_EQ_BENCH
+    buzzer_eq_bench();
+#endif
     nimble_port_freertos_init(blecent_host_task);
 
 }